@@ -1,13 +1,131 @@
+// The RSA_* key API is deprecated since OpenSSL 3.0 but still supported there, we target the
+// 1.1.1 API on purpose so the same code builds against 1.1 and 3.x without warnings
+#define OPENSSL_API_COMPAT 0x10101000L
 #include "crypto.h"
 #include <openssl/rsa.h>
 #include <openssl/bn.h>
 #include <openssl/err.h>
+#include <openssl/pem.h>
+#include <memory>
 #include "lambdautil.hpp"
+#include <algorithm>
+#ifdef OTSERVPP_CRYPTO_X86_SIMD
+#include <immintrin.h>
+#endif
 
 namespace otservpp { namespace crypto{
 
 boost::asio::io_service::id CryptoService::id;
 
+namespace{
+
+/// Index of the CryptoService worker running in this thread
+thread_local std::size_t workerIndex = 0;
+
+}
+
+CryptoService::CryptoService(boost::asio::io_service& ioService_) :
+	boost::asio::io_service::service(ioService_),
+	ioService(ioService_)
+{
+	std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for(std::size_t i = 0; i < threads; ++i)
+		workers.emplace_back([this, i]{ work(i); });
+}
+
+CryptoService::~CryptoService()
+{
+	stop();
+}
+
+void CryptoService::shutdown_service()
+{
+	stop();
+}
+
+bool CryptoService::post(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if(stopping || jobs.size() >= MaxQueuedJobs){
+			++rejected;
+			return false;
+		}
+
+		jobs.push_back(Job{std::move(job), Clock::now(),
+			boost::asio::io_service::work(ioService)});
+	}
+
+	jobAvailable.notify_one();
+	return true;
+}
+
+std::size_t CryptoService::currentWorker()
+{
+	return workerIndex;
+}
+
+CryptoService::Stats CryptoService::getStats()
+{
+	Stats stats;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.queueDepth = jobs.size();
+	}
+
+	stats.completed = completed;
+	stats.rejected = rejected;
+	stats.averageLatency = stats.completed? totalLatency/stats.completed : 0;
+	stats.maxLatency = maxLatency;
+	return stats;
+}
+
+void CryptoService::work(std::size_t index)
+{
+	workerIndex = index;
+
+	for(;;){
+		std::unique_lock<std::mutex> lock(mutex);
+		jobAvailable.wait(lock, [this]{ return stopping || !jobs.empty(); });
+
+		// pending jobs are still run when stopping
+		if(jobs.empty())
+			return;
+
+		Job job(std::move(jobs.front()));
+		jobs.pop_front();
+		lock.unlock();
+
+		job.run();
+
+		auto latency = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+				Clock::now() - job.queuedAt).count();
+
+		++completed;
+		totalLatency += latency;
+
+		auto max = maxLatency.load();
+		while(latency > max && !maxLatency.compare_exchange_weak(max, latency));
+	}
+}
+
+void CryptoService::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+
+	jobAvailable.notify_all();
+
+	for(auto& worker : workers){
+		if(worker.joinable())
+			worker.join();
+	}
+}
+
 ErrorCategory::ErrorCategory()
 {
 	static struct Init{
@@ -31,15 +149,21 @@ const boost::system::error_category& errorCategory()
 	return c;
 }
 
-uint32_t adler32(uint8_t* data, int32_t len)
-{
-	assert(len != 0);
+namespace{
+
+enum{
+	AdlerBase = 65521,
+	/// Max bytes that can be summed before b overflows 32 bits
+	AdlerNmax = 5552
+};
 
-	uint_fast32_t a = 1, b = 0;
-	int k;
+/// Scalar adler32 continuing from the given a and b
+uint32_t adler32Update(uint_fast32_t a, uint_fast32_t b, const uint8_t* data, std::size_t len)
+{
+	std::size_t k;
 	while(len > 0)
 	{
-		k = len > 5552? 5552 : len;
+		k = std::min<std::size_t>(len, AdlerNmax);
 		len -= k;
 
 		while(k >= 16){
@@ -68,94 +192,540 @@ uint32_t adler32(uint8_t* data, int32_t len)
 			} while (--k);
 		}
 
-		a %= 65521;
-		b %= 65521;
+		a %= AdlerBase;
+		b %= AdlerBase;
+	}
+
+	return (uint32_t)(b << 16) | (uint32_t)a;
+}
+
+typedef uint32_t (*Adler32Function)(uint32_t, const uint8_t*, std::size_t);
+
+Adler32Function selectAdler32()
+{
+#ifdef OTSERVPP_CRYPTO_X86_SIMD
+	if(detail::hasAvx2())
+		return detail::adler32Avx2;
+	if(detail::hasSsse3())
+		return detail::adler32Ssse3;
+#endif
+	return detail::adler32Scalar;
+}
+
+const Adler32Function adler32Impl = selectAdler32();
+
+/// The (sum + key) term of each XTEA round, which is the same for every block
+struct XteaRoundKeys{
+	explicit XteaRoundKeys(const uint32_t* key)
+	{
+		uint32_t sum = 0;
+		for(int i = 0; i != 32; ++i){
+			k0[i] = sum + key[sum & 3];
+			sum += 0x9E3779B9;
+			k1[i] = sum + key[sum >> 11 & 3];
+		}
+	}
+
+	uint32_t k0[32];
+	uint32_t k1[32];
+};
+
+void xteaEncryptBlocks(const XteaRoundKeys& rk, uint32_t* buffer, std::size_t blocks)
+{
+	for(; blocks != 0; --blocks, buffer += 2){
+		uint32_t v0 = buffer[0], v1 = buffer[1];
+
+		for(int i = 0; i != 32; ++i){
+			v0 += ((v1 << 4 ^ v1 >> 5) + v1) ^ rk.k0[i];
+			v1 += ((v0 << 4 ^ v0 >> 5) + v0) ^ rk.k1[i];
+		}
+
+		buffer[0] = v0;
+		buffer[1] = v1;
+	}
+}
+
+void xteaDecryptBlocks(const XteaRoundKeys& rk, uint32_t* buffer, std::size_t blocks)
+{
+	for(; blocks != 0; --blocks, buffer += 2){
+		uint32_t v0 = buffer[0], v1 = buffer[1];
+
+		for(int i = 31; i >= 0; --i){
+			v1 -= ((v0 << 4 ^ v0 >> 5) + v0) ^ rk.k1[i];
+			v0 -= ((v1 << 4 ^ v1 >> 5) + v1) ^ rk.k0[i];
+		}
+
+		buffer[0] = v0;
+		buffer[1] = v1;
+	}
+}
+
+typedef void (*XteaFunction)(const uint32_t*, uint32_t*, std::size_t);
+
+XteaFunction selectXteaEncrypt()
+{
+#ifdef OTSERVPP_CRYPTO_X86_SIMD
+	if(detail::hasAvx2())
+		return detail::xteaEncryptAvx2;
+	if(detail::hasSse2())
+		return detail::xteaEncryptSse2;
+#endif
+	return detail::xteaEncryptScalar;
+}
+
+XteaFunction selectXteaDecrypt()
+{
+#ifdef OTSERVPP_CRYPTO_X86_SIMD
+	if(detail::hasAvx2())
+		return detail::xteaDecryptAvx2;
+	if(detail::hasSse2())
+		return detail::xteaDecryptSse2;
+#endif
+	return detail::xteaDecryptScalar;
+}
+
+const XteaFunction xteaEncryptImpl = selectXteaEncrypt();
+const XteaFunction xteaDecryptImpl = selectXteaDecrypt();
+
+} // namespace
+
+uint32_t adler32(uint8_t* data, int32_t len)
+{
+	assert(len != 0);
+	return adler32Impl(1, data, (std::size_t)len);
+}
+
+uint32_t adler32(uint32_t adler, const uint8_t* data, std::size_t len)
+{
+	return adler32Impl(adler, data, len);
+}
+
+namespace detail{
+
+uint32_t adler32Scalar(uint32_t adler, const uint8_t* data, std::size_t len)
+{
+	return adler32Update(adler & 0xffff, adler >> 16, data, len);
+}
+
+#ifdef OTSERVPP_CRYPTO_X86_SIMD
+
+bool hasSse2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+bool hasSsse3()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("ssse3");
+}
+
+bool hasAvx2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+/*
+ * Both SIMD versions process 32 byte blocks. For each block a gets the sum of its bytes and
+ * b gets 32*a (a as it was before the block) plus the bytes weighted 32..1; the 32*a terms
+ * are accumulated in ps and added at the end of each NMAX sized chunk. Leftovers (less than
+ * a block) go through the scalar loop.
+ */
+__attribute__((target("ssse3")))
+uint32_t adler32Ssse3(uint32_t adler, const uint8_t* data, std::size_t len)
+{
+	uint32_t a = adler & 0xffff, b = adler >> 16;
+	std::size_t blocks = len/32;
+	len -= blocks*32;
+
+	const __m128i tap1 = _mm_setr_epi8(32,31,30,29,28,27,26,25,24,23,22,21,20,19,18,17);
+	const __m128i tap2 = _mm_setr_epi8(16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi16(1);
+
+	while(blocks != 0){
+		std::size_t n = std::min<std::size_t>(blocks, AdlerNmax/32);
+		blocks -= n;
+
+		__m128i ps = _mm_set_epi32(0, 0, 0, (int)(a*n));
+		__m128i vb = _mm_set_epi32(0, 0, 0, (int)b);
+		__m128i va = zero;
+
+		do{
+			__m128i bytes1 = _mm_loadu_si128((const __m128i*)data);
+			__m128i bytes2 = _mm_loadu_si128((const __m128i*)(data+16));
+
+			ps = _mm_add_epi32(ps, va);
+
+			va = _mm_add_epi32(va, _mm_sad_epu8(bytes1, zero));
+			vb = _mm_add_epi32(vb, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+
+			va = _mm_add_epi32(va, _mm_sad_epu8(bytes2, zero));
+			vb = _mm_add_epi32(vb, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+
+			data += 32;
+		} while(--n);
+
+		vb = _mm_add_epi32(vb, _mm_slli_epi32(ps, 5));
+
+		va = _mm_add_epi32(va, _mm_shuffle_epi32(va, _MM_SHUFFLE(1,0,3,2)));
+		va = _mm_add_epi32(va, _mm_shuffle_epi32(va, _MM_SHUFFLE(2,3,0,1)));
+		a += (uint32_t)_mm_cvtsi128_si32(va);
+
+		vb = _mm_add_epi32(vb, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1,0,3,2)));
+		vb = _mm_add_epi32(vb, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2,3,0,1)));
+		b = (uint32_t)_mm_cvtsi128_si32(vb);
+
+		a %= AdlerBase;
+		b %= AdlerBase;
 	}
 
-	return (uint32_t)(b << 16) | a;
+	return adler32Update(a, b, data, len);
 }
 
+__attribute__((target("avx2")))
+uint32_t adler32Avx2(uint32_t adler, const uint8_t* data, std::size_t len)
+{
+	uint32_t a = adler & 0xffff, b = adler >> 16;
+	std::size_t blocks = len/32;
+	len -= blocks*32;
+
+	const __m256i tap = _mm256_setr_epi8(32,31,30,29,28,27,26,25,24,23,22,21,20,19,18,17,
+			16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ones = _mm256_set1_epi16(1);
+
+	while(blocks != 0){
+		std::size_t n = std::min<std::size_t>(blocks, AdlerNmax/32);
+		blocks -= n;
+
+		__m256i ps = _mm256_set_epi32(0, 0, 0, 0, 0, 0, 0, (int)(a*n));
+		__m256i vb = _mm256_set_epi32(0, 0, 0, 0, 0, 0, 0, (int)b);
+		__m256i va = zero;
+
+		do{
+			__m256i bytes = _mm256_loadu_si256((const __m256i*)data);
+
+			ps = _mm256_add_epi32(ps, va);
+			va = _mm256_add_epi32(va, _mm256_sad_epu8(bytes, zero));
+			vb = _mm256_add_epi32(vb, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, tap), ones));
+
+			data += 32;
+		} while(--n);
+
+		vb = _mm256_add_epi32(vb, _mm256_slli_epi32(ps, 5));
+
+		__m128i sa = _mm_add_epi32(_mm256_castsi256_si128(va), _mm256_extracti128_si256(va, 1));
+		sa = _mm_add_epi32(sa, _mm_shuffle_epi32(sa, _MM_SHUFFLE(1,0,3,2)));
+		sa = _mm_add_epi32(sa, _mm_shuffle_epi32(sa, _MM_SHUFFLE(2,3,0,1)));
+		a += (uint32_t)_mm_cvtsi128_si32(sa);
+
+		__m128i sb = _mm_add_epi32(_mm256_castsi256_si128(vb), _mm256_extracti128_si256(vb, 1));
+		sb = _mm_add_epi32(sb, _mm_shuffle_epi32(sb, _MM_SHUFFLE(1,0,3,2)));
+		sb = _mm_add_epi32(sb, _mm_shuffle_epi32(sb, _MM_SHUFFLE(2,3,0,1)));
+		b = (uint32_t)_mm_cvtsi128_si32(sb);
+
+		a %= AdlerBase;
+		b %= AdlerBase;
+	}
+
+	return adler32Update(a, b, data, len);
+}
+
+#endif // OTSERVPP_CRYPTO_X86_SIMD
+
+} /* namespace detail */
+
 Xtea::Xtea(uint32_t k0, uint32_t k1, uint32_t k2, uint32_t k3) :
 	key{k0, k1, k2, k3}
 {}
 
 void Xtea::decrypt(uint32_t* buffer, std::size_t lenght) const
 {
-	uint32_t k[4] {key[0], key[1], key[2], key[3]};
+	xteaDecryptImpl(key, buffer, lenght);
+}
 
-	uint pos = 0, round;
-	uint32_t v0, v1, sum, delta;
+void Xtea::encrypt(uint32_t* buffer, std::size_t lenght) const
+{
+	xteaEncryptImpl(key, buffer, lenght);
+}
 
-	while(pos < lenght/4){
-		v0 = buffer[pos];
-		v1 = buffer[pos+1];
-		delta = 0x9E3779B9;
-		sum = delta << 5;
+namespace detail{
 
-		round = 32;
-		while(round-- > 0){
-			v1 -= ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + k[sum >> 11 & 3]);
-			sum -= delta;
-			v0 -= ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + k[sum & 3]);
+void xteaEncryptScalar(const uint32_t* key, uint32_t* buffer, std::size_t length)
+{
+	XteaRoundKeys rk(key);
+	xteaEncryptBlocks(rk, buffer, length/8);
+}
+
+void xteaDecryptScalar(const uint32_t* key, uint32_t* buffer, std::size_t length)
+{
+	XteaRoundKeys rk(key);
+	xteaDecryptBlocks(rk, buffer, length/8);
+}
+
+#ifdef OTSERVPP_CRYPTO_X86_SIMD
+
+/*
+ * The SIMD versions load the blocks of a pass in two registers and split them into a register
+ * of v0 words and another of v1 words (in a lane order that unpacking restores), then run the
+ * same rounds as the scalar version on every lane. Leftover blocks go through the scalar loop.
+ */
+__attribute__((target("sse2")))
+void xteaEncryptSse2(const uint32_t* key, uint32_t* buffer, std::size_t length)
+{
+	XteaRoundKeys rk(key);
+	std::size_t blocks = length/8;
+
+	for(; blocks >= 4; blocks -= 4, buffer += 8){
+		__m128 lo = _mm_loadu_ps((const float*)buffer);
+		__m128 hi = _mm_loadu_ps((const float*)(buffer+4));
+		__m128i v0 = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2,0,2,0)));
+		__m128i v1 = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3,1,3,1)));
+
+		for(int i = 0; i != 32; ++i){
+			__m128i f = _mm_add_epi32(
+					_mm_xor_si128(_mm_slli_epi32(v1, 4), _mm_srli_epi32(v1, 5)), v1);
+			v0 = _mm_add_epi32(v0, _mm_xor_si128(f, _mm_set1_epi32((int)rk.k0[i])));
+			f = _mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(v0, 4), _mm_srli_epi32(v0, 5)), v0);
+			v1 = _mm_add_epi32(v1, _mm_xor_si128(f, _mm_set1_epi32((int)rk.k1[i])));
 		}
 
-		buffer[pos] = v0;
-		buffer[pos+1] = v1;
-		pos += 2;
+		_mm_storeu_si128((__m128i*)buffer, _mm_unpacklo_epi32(v0, v1));
+		_mm_storeu_si128((__m128i*)(buffer+4), _mm_unpackhi_epi32(v0, v1));
 	}
+
+	xteaEncryptBlocks(rk, buffer, blocks);
 }
 
-void Xtea::encrypt(uint32_t* buffer, std::size_t lenght) const
+__attribute__((target("sse2")))
+void xteaDecryptSse2(const uint32_t* key, uint32_t* buffer, std::size_t length)
 {
-	uint32_t k[4] {key[0], key[1], key[2], key[3]};
+	XteaRoundKeys rk(key);
+	std::size_t blocks = length/8;
 
-	uint pos = 0, round;
-	uint32_t v0, v1, sum;
+	for(; blocks >= 4; blocks -= 4, buffer += 8){
+		__m128 lo = _mm_loadu_ps((const float*)buffer);
+		__m128 hi = _mm_loadu_ps((const float*)(buffer+4));
+		__m128i v0 = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2,0,2,0)));
+		__m128i v1 = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3,1,3,1)));
 
-	while(pos < lenght/4){
-		v0 = buffer[pos];
-		v1 = buffer[pos+1];
-		sum = 0;
+		for(int i = 31; i >= 0; --i){
+			__m128i f = _mm_add_epi32(
+					_mm_xor_si128(_mm_slli_epi32(v0, 4), _mm_srli_epi32(v0, 5)), v0);
+			v1 = _mm_sub_epi32(v1, _mm_xor_si128(f, _mm_set1_epi32((int)rk.k1[i])));
+			f = _mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(v1, 4), _mm_srli_epi32(v1, 5)), v1);
+			v0 = _mm_sub_epi32(v0, _mm_xor_si128(f, _mm_set1_epi32((int)rk.k0[i])));
+		}
 
-		round = 32;
-		while(round-- > 0){
-			v0 += ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + k[sum & 3]);
-			sum += 0x9E3779B9;
-			v1 += ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + k[sum >> 11 & 3]);
+		_mm_storeu_si128((__m128i*)buffer, _mm_unpacklo_epi32(v0, v1));
+		_mm_storeu_si128((__m128i*)(buffer+4), _mm_unpackhi_epi32(v0, v1));
+	}
+
+	xteaDecryptBlocks(rk, buffer, blocks);
+}
+
+__attribute__((target("avx2")))
+void xteaEncryptAvx2(const uint32_t* key, uint32_t* buffer, std::size_t length)
+{
+	XteaRoundKeys rk(key);
+	std::size_t blocks = length/8;
+
+	for(; blocks >= 8; blocks -= 8, buffer += 16){
+		__m256 lo = _mm256_loadu_ps((const float*)buffer);
+		__m256 hi = _mm256_loadu_ps((const float*)(buffer+8));
+		__m256i v0 = _mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2,0,2,0)));
+		__m256i v1 = _mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3,1,3,1)));
+
+		for(int i = 0; i != 32; ++i){
+			__m256i f = _mm256_add_epi32(
+					_mm256_xor_si256(_mm256_slli_epi32(v1, 4), _mm256_srli_epi32(v1, 5)), v1);
+			v0 = _mm256_add_epi32(v0, _mm256_xor_si256(f, _mm256_set1_epi32((int)rk.k0[i])));
+			f = _mm256_add_epi32(
+					_mm256_xor_si256(_mm256_slli_epi32(v0, 4), _mm256_srli_epi32(v0, 5)), v0);
+			v1 = _mm256_add_epi32(v1, _mm256_xor_si256(f, _mm256_set1_epi32((int)rk.k1[i])));
 		}
 
-		buffer[pos] = v0;
-		buffer[pos+1] = v1;
-		pos += 2;
+		_mm256_storeu_si256((__m256i*)buffer, _mm256_unpacklo_epi32(v0, v1));
+		_mm256_storeu_si256((__m256i*)(buffer+8), _mm256_unpackhi_epi32(v0, v1));
 	}
+
+	xteaEncryptBlocks(rk, buffer, blocks);
+}
+
+__attribute__((target("avx2")))
+void xteaDecryptAvx2(const uint32_t* key, uint32_t* buffer, std::size_t length)
+{
+	XteaRoundKeys rk(key);
+	std::size_t blocks = length/8;
+
+	for(; blocks >= 8; blocks -= 8, buffer += 16){
+		__m256 lo = _mm256_loadu_ps((const float*)buffer);
+		__m256 hi = _mm256_loadu_ps((const float*)(buffer+8));
+		__m256i v0 = _mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2,0,2,0)));
+		__m256i v1 = _mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3,1,3,1)));
+
+		for(int i = 31; i >= 0; --i){
+			__m256i f = _mm256_add_epi32(
+					_mm256_xor_si256(_mm256_slli_epi32(v0, 4), _mm256_srli_epi32(v0, 5)), v0);
+			v1 = _mm256_sub_epi32(v1, _mm256_xor_si256(f, _mm256_set1_epi32((int)rk.k1[i])));
+			f = _mm256_add_epi32(
+					_mm256_xor_si256(_mm256_slli_epi32(v1, 4), _mm256_srli_epi32(v1, 5)), v1);
+			v0 = _mm256_sub_epi32(v0, _mm256_xor_si256(f, _mm256_set1_epi32((int)rk.k0[i])));
+		}
+
+		_mm256_storeu_si256((__m256i*)buffer, _mm256_unpacklo_epi32(v0, v1));
+		_mm256_storeu_si256((__m256i*)(buffer+8), _mm256_unpackhi_epi32(v0, v1));
+	}
+
+	xteaDecryptBlocks(rk, buffer, blocks);
+}
+
+#endif // OTSERVPP_CRYPTO_X86_SIMD
+
+} /* namespace detail */
+
+namespace{
+
+[[noreturn]] void throwCryptoError()
+{
+	throw boost::system::system_error(static_cast<int>(ERR_get_error()), errorCategory());
+}
+
+typedef std::unique_ptr<BIGNUM, void(*)(BIGNUM*)> BigNumPtr;
+
+BigNumPtr newBigNum()
+{
+	BigNumPtr bn(BN_new(), BN_clear_free);
+	if(!bn)
+		throwCryptoError();
+	return bn;
 }
 
+BigNumPtr decToBigNum(const char* dec)
+{
+	BIGNUM* bn = nullptr;
+	if(!BN_dec2bn(&bn, dec))
+		throwCryptoError();
+	return BigNumPtr(bn, BN_clear_free);
+}
+
+/// Fills rsa with the given key, deriving dmp1 = d mod (p-1), dmq1 = d mod (q-1) and
+/// iqmp = q^-1 mod p so OpenSSL can use the CRT
+void setRsaKey(RSA* rsa,
+		const char* n_, const char* e_, const char* d_, const char* p_, const char* q_)
+{
+	auto n = decToBigNum(n_), e = decToBigNum(e_), d = decToBigNum(d_);
+	auto p = decToBigNum(p_), q = decToBigNum(q_);
+	auto p1 = newBigNum(), q1 = newBigNum();
+	auto dmp1 = newBigNum(), dmq1 = newBigNum(), iqmp = newBigNum();
+
+	std::unique_ptr<BN_CTX, void(*)(BN_CTX*)> ctx(BN_CTX_new(), BN_CTX_free);
+
+	if(!ctx || !BN_sub(p1.get(), p.get(), BN_value_one()) ||
+			!BN_sub(q1.get(), q.get(), BN_value_one()) ||
+			!BN_mod(dmp1.get(), d.get(), p1.get(), ctx.get()) ||
+			!BN_mod(dmq1.get(), d.get(), q1.get(), ctx.get()) ||
+			!BN_mod_inverse(iqmp.get(), q.get(), p.get(), ctx.get()))
+		throwCryptoError();
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	// on success the RSA structure takes ownership
+	if(!RSA_set0_key(rsa, n.get(), e.get(), d.get()))
+		throwCryptoError();
+	n.release(); e.release(); d.release();
+
+	if(!RSA_set0_factors(rsa, p.get(), q.get()))
+		throwCryptoError();
+	p.release(); q.release();
+
+	if(!RSA_set0_crt_params(rsa, dmp1.get(), dmq1.get(), iqmp.get()))
+		throwCryptoError();
+	dmp1.release(); dmq1.release(); iqmp.release();
+#else
+	rsa->n = n.release();
+	rsa->e = e.release();
+	rsa->d = d.release();
+	rsa->p = p.release();
+	rsa->q = q.release();
+	rsa->dmp1 = dmp1.release();
+	rsa->dmq1 = dmq1.release();
+	rsa->iqmp = iqmp.release();
+#endif
+}
+
+} // namespace
 
 Rsa::Rsa(boost::asio::io_service& ioService,
 		 const char* n, const char* e, const char* d, const char* p, const char* q) :
 	rsa(RSA_new()),
 	svc(boost::asio::use_service<CryptoService>(ioService))
 {
-	int ok = BN_dec2bn(&rsa->n, n)?
-			(BN_dec2bn(&rsa->e, e)?
-			(BN_dec2bn(&rsa->d, d)?
-			(BN_dec2bn(&rsa->p, p)?
-			 BN_dec2bn(&rsa->q, q):0):0):0):0;
+	try{
+		if(!rsa)
+			throwCryptoError();
 
-	if(!ok || RSA_check_key(rsa) < 1){
+		setRsaKey(rsa, n, e, d, p, q);
+
+		if(RSA_check_key(rsa) < 1)
+			throwCryptoError();
+
+		copyForWorkers();
+	} catch(...){
+		for(auto copy : workerRsa)
+			RSA_free(copy);
 		RSA_free(rsa);
-		throw boost::system::system_error(static_cast<int>(ERR_get_error()), errorCategory());
+		throw;
+	}
+}
+
+Rsa::Rsa(boost::asio::io_service& ioService, const std::string& pemFile) :
+	rsa(nullptr),
+	svc(boost::asio::use_service<CryptoService>(ioService))
+{
+	std::unique_ptr<BIO, int(*)(BIO*)> bio(BIO_new_file(pemFile.c_str(), "r"), BIO_free);
+
+	if(bio)
+		rsa = PEM_read_bio_RSAPrivateKey(bio.get(), nullptr, nullptr, nullptr);
+
+	if(!rsa)
+		throwCryptoError();
+
+	try{
+		if(RSA_check_key(rsa) < 1)
+			throwCryptoError();
+
+		copyForWorkers();
+	} catch(...){
+		for(auto copy : workerRsa)
+			RSA_free(copy);
+		RSA_free(rsa);
+		throw;
+	}
+}
+
+void Rsa::copyForWorkers()
+{
+	for(std::size_t i = 0; i < svc.size(); ++i){
+		workerRsa.push_back(RSAPrivateKey_dup(rsa));
+		if(!workerRsa.back())
+			throwCryptoError();
 	}
 }
 
 Rsa::~Rsa()
 {
+	for(auto copy : workerRsa)
+		RSA_free(copy);
 	RSA_free(rsa);
 }
 
 int Rsa::decrypt(uint8_t* buffer, std::size_t length, boost::system::error_condition& e)
 {
-	int newLen = RSA_private_decrypt((int)length, buffer, buffer, rsa, RSA_NO_PADDING);
+	int newLen = RSA_private_decrypt((int)length, buffer, buffer,
+			workerRsa[CryptoService::currentWorker()], RSA_NO_PADDING);
 
 	if(newLen == -1)
 		e.assign(static_cast<int>(ERR_get_error()), errorCategory());
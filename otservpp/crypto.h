@@ -1,8 +1,15 @@
 #ifndef OTSERVP_CRYPTO_H_
 #define OTSERVP_CRYPTO_H_
 
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
 #include <boost/asio/io_service.hpp>
-#include <boost/asio/strand.hpp>
 
 typedef struct rsa_st RSA; // openssl rsa struct
 
@@ -19,43 +26,128 @@ public:
 
 const boost::system::error_category& errorCategory();
 
-/*! Asynchronous support for openssl
- * Openssl (the lib we use for RSA) requires us to define a set of lock callback functions in
- * order to be used in multi-threaded applications. Since I don't want to read the documentation,
- * we will do it async. (it's probably a waste of time since the only place RSA is used is on
- * during fist contact with a client, i.e. the login protocol).
+/*! Thread pool for the expensive crypto operations (i.e. RSA, during logins)
+ * Jobs are queued in a bounded queue and run by a fixed set of worker threads, one per core,
+ * so logins from different connections are decrypted in parallel. OpenSSL 1.1+ is thread-safe,
+ * anyway each worker uses its own copy of the keys so they don't contend on blinding locks.
  *
- * Here we just serialize the access to anything that needs openssl functionality, using an
- * implicit lock (asio strand).
+ * The io_service is kept busy while jobs are pending, jobs post their completions back to it.
+ * \note All the functions in this class are thread-safe
  */
 class CryptoService : public boost::asio::io_service::service{
 public:
 	static boost::asio::io_service::id id;
 
-	explicit CryptoService(boost::asio::io_service& ioService) :
-		boost::asio::io_service::service(ioService),
-		strand(ioService)
-	{}
+	/// Jobs posted while the queue is this long are rejected
+	enum{ MaxQueuedJobs = 1024 };
 
-	template <class Func>
-	void runSync(Func&& alg)
+	struct Stats{
+		std::size_t queueDepth;
+		uint64_t completed;
+		uint64_t rejected;
+		/// Since the job is queued until it's done, in microseconds
+		uint64_t averageLatency;
+		uint64_t maxLatency;
+	};
+
+	explicit CryptoService(boost::asio::io_service& ioService);
+
+	~CryptoService();
+
+	/// Queues job to be run by a worker thread, returns false if the queue is full
+	bool post(std::function<void()> job);
+
+	/// Number of worker threads
+	std::size_t size() const
+	{
+		return workers.size();
+	}
+
+	/// Index of the worker thread calling this function, in [0, size())
+	static std::size_t currentWorker();
+
+	Stats getStats();
+
+	boost::asio::io_service& getIoService()
 	{
-		strand.dispatch([=]() mutable{ alg(); });
+		return ioService;
 	}
 
-	void shutdown_service() override {}
+	void shutdown_service() override;
 
 private:
-	boost::asio::strand strand;
+	typedef std::chrono::steady_clock Clock;
+
+	struct Job{
+		std::function<void()> run;
+		Clock::time_point queuedAt;
+		boost::asio::io_service::work work;
+	};
+
+	void work(std::size_t index);
+
+	void stop();
+
+	boost::asio::io_service& ioService;
+	std::mutex mutex;
+	std::condition_variable jobAvailable;
+	std::deque<Job> jobs;
+	std::vector<std::thread> workers;
+	bool stopping {false};
+
+	std::atomic<uint64_t> completed {0};
+	std::atomic<uint64_t> rejected {0};
+	std::atomic<uint64_t> totalLatency {0};
+	std::atomic<uint64_t> maxLatency {0};
 };
 
-/// Sems like a good place for this
+/*! Sems like a good place for this
+ * Uses the widest SIMD implementation supported by the CPU, picked once at startup.
+ */
 uint32_t adler32(uint8_t* data, int32_t len);
 
-/// XTEA cypher
+/// Continues the checksum adler (1 for an empty one) with len more bytes
+uint32_t adler32(uint32_t adler, const uint8_t* data, std::size_t len);
+
+/// Every adler32 implementation, exposed for testing and benchmarking
+namespace detail{
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OTSERVPP_CRYPTO_X86_SIMD
+#endif
+
+uint32_t adler32Scalar(uint32_t adler, const uint8_t* data, std::size_t len);
+
+void xteaEncryptScalar(const uint32_t* key, uint32_t* buffer, std::size_t length);
+void xteaDecryptScalar(const uint32_t* key, uint32_t* buffer, std::size_t length);
+
+#ifdef OTSERVPP_CRYPTO_X86_SIMD
+bool hasSse2();
+bool hasSsse3();
+bool hasAvx2();
+
+uint32_t adler32Ssse3(uint32_t adler, const uint8_t* data, std::size_t len);
+uint32_t adler32Avx2(uint32_t adler, const uint8_t* data, std::size_t len);
+
+/// 4 blocks per pass
+void xteaEncryptSse2(const uint32_t* key, uint32_t* buffer, std::size_t length);
+void xteaDecryptSse2(const uint32_t* key, uint32_t* buffer, std::size_t length);
+
+/// 8 blocks per pass
+void xteaEncryptAvx2(const uint32_t* key, uint32_t* buffer, std::size_t length);
+void xteaDecryptAvx2(const uint32_t* key, uint32_t* buffer, std::size_t length);
+#endif
+
+} /* namespace detail */
+
+/*! XTEA cypher
+ * Blocks are independent, so they are processed several at once in SIMD lanes when the CPU
+ * supports it. The lenght (in bytes) of the buffers should be a multiple of 8.
+ */
 class Xtea{
 public:
-	Xtea(){}
+	/// An all-zeros key, until a real one is assigned (e.g. from the client's login message)
+	Xtea() : key{} {}
 
 	Xtea(uint32_t v0, uint32_t v1, uint32_t v2, uint32_t v3);
 
@@ -67,30 +159,58 @@ private:
 	uint32_t key[4];
 };
 
-/// RSA cypher
+/*! RSA cypher
+ * Private keys always carry their CRT parameters, so decryption does two half-size modular
+ * exponentiations instead of a full-size one.
+ */
 class Rsa{
 public:
-	/// Constructs a new RSA structure using the given io_service and keys, throws
-	/// boost::system::system_error on failure
+	/// Constructs a new RSA structure using the given io_service and keys (in decimal), the CRT
+	/// parameters are derived from them. Throws boost::system::system_error on failure
 	Rsa(boost::asio::io_service& ioService,
 		const char* n, const char* e, const char* d, const char* p, const char* q);
 
+	/// Constructs a new RSA structure with the private key stored in the given PEM file,
+	/// throws boost::system::system_error on failure
+	Rsa(boost::asio::io_service& ioService, const std::string& pemFile);
+
 	~Rsa();
 
+	/*! Decrypts buffer in a CryptoService worker, then calls handler(error_condition&, newLen)
+	 * from the io_service. When too many decryptions are queued already the handler is called
+	 * with errc::resource_unavailable_try_again.
+	 */
 	template <class Handler>
 	void decrypt(uint8_t* buffer, std::size_t length, Handler&& handler)
 	{
-		svc.runSync([=]() mutable{
+		auto& ioService = svc.getIoService();
+
+		bool queued = svc.post([=, &ioService]() mutable{
 			boost::system::error_condition e;
 			int newLen = decrypt(buffer, length, e);
-			handler(e, newLen);
+			ioService.post([=]() mutable{ handler(e, newLen); });
 		});
+
+		if(!queued){
+			ioService.post([=]() mutable{
+				auto e = boost::system::errc::make_error_condition(
+						boost::system::errc::resource_unavailable_try_again);
+				handler(e, -1);
+			});
+		}
 	}
 
+	Rsa(Rsa&) = delete;
+	void operator=(Rsa&) = delete;
+
 private:
 	int decrypt(uint8_t* buffer, std::size_t lenght, boost::system::error_condition& e);
 
+	/// Gives every CryptoService worker its own copy of the key
+	void copyForWorkers();
+
 	RSA* rsa;
+	std::vector<RSA*> workerRsa;
 	CryptoService& svc;
 };
 
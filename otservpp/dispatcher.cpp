@@ -0,0 +1,174 @@
+#include "dispatcher.h"
+#include <algorithm>
+#include <glog/logging.h>
+#include "timerwheel.h"
+#include "protocol/gameinbox.h"
+#include "protocol/tickflushlist.h"
+
+namespace otservpp {
+
+namespace{
+
+uint64_t toMicroseconds(std::chrono::steady_clock::duration d)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+}
+
+Dispatcher::Dispatcher(boost::asio::io_service& ioService, int tickLength_) :
+	timer(ioService),
+	timerWheel(boost::asio::use_service<TimerWheel>(ioService)),
+	tickLength(tickLength_)
+{
+	addPhase("input", Critical, []{ GameInbox::instance().drain(); });
+	addPhase("timers", Critical, [this]{ timerWheel.poll(); });
+	addPhase("output", Critical, []{ TickFlushList::instance().flushAll(); });
+}
+
+Dispatcher::~Dispatcher()
+{
+	stop();
+}
+
+void Dispatcher::addPhase(std::string name, Priority priority, std::function<void()> phase)
+{
+	Phase p {PhaseStats{std::move(name), priority, 0, 0, 0, 0, 0}, std::move(phase), 0, 0};
+
+	// the built-in output phase, added by the constructor, stays the last one
+	std::lock_guard<std::mutex> lock(statsMutex);
+	if(phases.size() < 3)
+		phases.push_back(std::move(p));
+	else
+		phases.insert(phases.end()-1, std::move(p));
+}
+
+void Dispatcher::start()
+{
+	// timers only run in their phase, not from the io_service between ticks
+	timerWheel.setPolled(true);
+	TickFlushList::instance().setDriven(true);
+
+	running = true;
+	nextTick = Clock::now() + tickLength;
+	scheduleNext();
+}
+
+void Dispatcher::stop()
+{
+	if(!running)
+		return;
+
+	running = false;
+	SystemErrorCode ignored;
+	timer.cancel(ignored);
+
+	timerWheel.setPolled(false);
+
+	// protocols flush by themselves from now on, the output phase won't run for what's left.
+	// Posted, stop() may be called from a phase
+	TickFlushList::instance().setDriven(false);
+	timer.get_io_service().post([]{ TickFlushList::instance().flushAll(); });
+}
+
+void Dispatcher::tick()
+{
+	auto begin = Clock::now();
+
+	for(auto& phase : phases){
+		if(shouldRun(phase, Clock::now() - begin)){
+			run(phase);
+		} else {
+			std::lock_guard<std::mutex> lock(statsMutex);
+			++phase.stats.skipped;
+			++phase.consecutiveSkips;
+		}
+	}
+
+	auto elapsed = Clock::now() - begin;
+	lastTickOverran = elapsed > tickLength;
+
+	std::lock_guard<std::mutex> lock(statsMutex);
+	++ticks;
+	lastTickTime = toMicroseconds(elapsed);
+	maxTickTime = std::max(maxTickTime, lastTickTime);
+	if(lastTickOverran)
+		++overruns;
+}
+
+Dispatcher::Stats Dispatcher::getStats()
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+
+	Stats stats {ticks, overruns, missedTicks, lastTickTime, maxTickTime, {}};
+	for(auto& phase : phases)
+		stats.phases.push_back(phase.stats);
+
+	return stats;
+}
+
+bool Dispatcher::shouldRun(const Phase& phase, Clock::duration elapsed) const
+{
+	if(phase.stats.priority == Critical || phase.consecutiveSkips >= MaxConsecutiveSkips)
+		return true;
+
+	if(phase.stats.priority == Normal)
+		return elapsed < tickLength;
+
+	auto expected = std::chrono::microseconds(phase.stats.averageTime);
+	return !lastTickOverran && elapsed + expected <= tickLength;
+}
+
+void Dispatcher::run(Phase& phase)
+{
+	auto begin = Clock::now();
+
+	try{
+		phase.run();
+	} catch(std::exception& e){
+		LOG(ERROR) << "Uncaught exception in dispatcher phase " << phase.stats.name << ": "
+				<< e.what();
+	}
+
+	auto time = toMicroseconds(Clock::now() - begin);
+
+	std::lock_guard<std::mutex> lock(statsMutex);
+	auto& stats = phase.stats;
+	++stats.runs;
+	stats.lastTime = time;
+	stats.maxTime = std::max(stats.maxTime, time);
+	phase.totalTime += time;
+	stats.averageTime = phase.totalTime / stats.runs;
+	phase.consecutiveSkips = 0;
+}
+
+void Dispatcher::scheduleNext()
+{
+	timer.expires_at(nextTick);
+	timer.async_wait([this](const SystemErrorCode& e){ onTick(e); });
+}
+
+void Dispatcher::onTick(const SystemErrorCode& e)
+{
+	if(e == boost::asio::error::operation_aborted || !running)
+		return;
+
+	tick();
+
+	// fixed rate, a late tick runs right away without pushing the next ones back, unless
+	// whole periods were lost
+	nextTick += tickLength;
+	auto late = Clock::now() - nextTick;
+	if(late >= tickLength){
+		auto lost = late / tickLength;
+		nextTick += lost * tickLength;
+
+		std::lock_guard<std::mutex> lock(statsMutex);
+		missedTicks += lost;
+	}
+
+	if(running)
+		scheduleNext();
+}
+
+} /* namespace otservpp */
@@ -0,0 +1,151 @@
+#ifndef OTSERVPP_DISPATCHER_H_
+#define OTSERVPP_DISPATCHER_H_
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+#include <boost/asio/steady_timer.hpp>
+#include "networkdcl.hpp"
+
+namespace otservpp {
+
+class TimerWheel;
+
+/*! Fixed-rate game loop
+ * Every tick runs the following phases, in this order:
+ * 	- "input": the messages queued in the GameInbox
+ * 	- "timers": the expired timers of the io_service's TimerWheel, which doesn't wake up by
+ * 	  itself while the dispatcher is started (see TimerWheel::setPolled())
+ * 	- the phases added with addPhase(), in the order they were added
+ * 	- "output": the flushes queued in the TickFlushList, so every connection gets a single
+ * 	  packet per tick
+ *
+ * Ticks are scheduled at fixed points in time (start + n*tickLength), a late tick doesn't
+ * delay the following ones. When ticks are so late that whole periods are lost they are
+ * counted as missed instead of being run in a burst.
+ *
+ * The time spent in each phase is accounted against the tick length. Critical phases always
+ * run, Normal phases are skipped once the tick has used up its budget and Low phases are also
+ * skipped if they are not expected to fit in what's left, or if the previous tick overran.
+ * A phase is never skipped more than MaxConsecutiveSkips ticks in a row.
+ *
+ * The phases run in the io_service given in the constructor, which should be ran by a single
+ * thread (the game thread).
+ */
+class Dispatcher{
+public:
+	enum Priority{
+		Critical,
+		Normal,
+		Low
+	};
+
+	enum{
+		DefaultTickLength = 50,
+		MaxConsecutiveSkips = 20
+	};
+
+	/// Times in microseconds
+	struct PhaseStats{
+		std::string name;
+		Priority priority;
+		uint64_t runs;
+		uint64_t skipped;
+		uint64_t lastTime;
+		uint64_t averageTime;
+		uint64_t maxTime;
+	};
+
+	/// Times in microseconds
+	struct Stats{
+		uint64_t ticks;
+		/// Ticks that took longer than tickLength
+		uint64_t overruns;
+		/// Periods lost because ticks were too late
+		uint64_t missedTicks;
+		uint64_t lastTickTime;
+		uint64_t maxTickTime;
+		std::vector<PhaseStats> phases;
+	};
+
+	/// Makes a dispatcher ticking every tickLength milliseconds
+	explicit Dispatcher(boost::asio::io_service& ioService, int tickLength = DefaultTickLength);
+
+	/// Stops the dispatcher
+	~Dispatcher();
+
+	/*! Adds a phase to be run every tick, after the built-in input and timer phases and before
+	 * the output one
+	 * \warning Phases must be added before start()
+	 */
+	void addPhase(std::string name, Priority priority, std::function<void()> phase);
+
+	/*! Starts ticking, the first tick is run tickLength milliseconds from now
+	 * From now on the TimerWheel only runs timers from the "timers" phase, and the
+	 * TickFlushList is driven by the "output" phase.
+	 */
+	void start();
+
+	/*! Stops ticking, a tick already running is finished
+	 * The TimerWheel gets its driver timer back, so timers keep firing from the io_service,
+	 * and the flushes left in the TickFlushList are run from the io_service.
+	 */
+	void stop();
+
+	/// Runs a whole tick right now, start() calls this periodically
+	void tick();
+
+	int getTickLength() const
+	{
+		return tickLength.count();
+	}
+
+	/// \note This function is thread-safe
+	Stats getStats();
+
+	Dispatcher(Dispatcher&) = delete;
+	void operator=(Dispatcher&) = delete;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Phase{
+		PhaseStats stats;
+		std::function<void()> run;
+		uint64_t totalTime;
+		unsigned consecutiveSkips;
+	};
+
+	/// Decides whether phase fits in the current tick, elapsed since the tick began
+	bool shouldRun(const Phase& phase, Clock::duration elapsed) const;
+
+	/// Runs phase updating its stats
+	void run(Phase& phase);
+
+	void scheduleNext();
+
+	void onTick(const SystemErrorCode& e);
+
+	boost::asio::steady_timer timer;
+	TimerWheel& timerWheel;
+	std::chrono::milliseconds tickLength;
+	Clock::time_point nextTick;
+	bool running {false};
+	bool lastTickOverran {false};
+
+	std::mutex statsMutex;
+	uint64_t ticks {0};
+	uint64_t overruns {0};
+	uint64_t missedTicks {0};
+	uint64_t lastTickTime {0};
+	uint64_t maxTickTime {0};
+
+	/// Output is always the last one
+	std::vector<Phase> phases;
+};
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_DISPATCHER_H_
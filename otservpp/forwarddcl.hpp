@@ -44,10 +44,12 @@ class StandardOutMessage;
 
 class DeferredTask;
 class IntervalTask;
+class TaskGroup;
 class Dispatcher;
 
 typedef std::shared_ptr<DeferredTask> DeferredTaskPtr;
 typedef std::shared_ptr<IntervalTask> IntervalTaskPtr;
+typedef std::shared_ptr<TaskGroup> TaskGroupPtr;
 
 class LoginProtocol;
 
@@ -0,0 +1,185 @@
+#ifndef OTSERVPP_INLINEFUNCTION_HPP_
+#define OTSERVPP_INLINEFUNCTION_HPP_
+
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+
+namespace otservpp {
+
+template <class Signature, std::size_t INLINE_SIZE = 48>
+class InlineFunction;
+
+/*! Move-only std::function replacement with a small buffer
+ * Callables of up to INLINE_SIZE bytes (that can be moved without throwing) are stored in
+ * the object itself, so wrapping the usual "a pointer and an int" lambda never allocates.
+ * Bigger ones are moved to the heap, as std::function does.
+ *
+ * Since it's move-only it can also hold move-only callables. The scheduler stores its tasks
+ * and timer handlers in these.
+ */
+template <class R, class... Args, std::size_t INLINE_SIZE>
+class InlineFunction<R(Args...), INLINE_SIZE>{
+public:
+	typedef R result_type;
+
+	/// Returns true if a Func is stored without allocating
+	template <class Func>
+	static constexpr bool isInline()
+	{
+		return sizeof(Func) <= INLINE_SIZE && alignof(Func) <= alignof(Storage)
+				&& std::is_nothrow_move_constructible<Func>::value;
+	}
+
+	InlineFunction() :
+		ops(nullptr)
+	{}
+
+	InlineFunction(std::nullptr_t) :
+		ops(nullptr)
+	{}
+
+	template <class Func, class = typename std::enable_if<
+		!std::is_same<typename std::decay<Func>::type, InlineFunction>::value>::type>
+	InlineFunction(Func&& func)
+	{
+		typedef typename std::decay<Func>::type F;
+		construct<F>(std::forward<Func>(func), std::integral_constant<bool, isInline<F>()>());
+	}
+
+	InlineFunction(InlineFunction&& o) noexcept :
+		ops(o.ops)
+	{
+		if(ops){
+			ops->move(&storage, &o.storage);
+			o.ops = nullptr;
+		}
+	}
+
+	InlineFunction& operator=(InlineFunction&& o) noexcept
+	{
+		if(this != &o){
+			reset();
+			if((ops = o.ops)){
+				ops->move(&storage, &o.storage);
+				o.ops = nullptr;
+			}
+		}
+		return *this;
+	}
+
+	InlineFunction& operator=(std::nullptr_t)
+	{
+		reset();
+		return *this;
+	}
+
+	~InlineFunction()
+	{
+		reset();
+	}
+
+	R operator()(Args... args)
+	{
+		return ops->invoke(&storage, std::forward<Args>(args)...);
+	}
+
+	explicit operator bool() const
+	{
+		return ops != nullptr;
+	}
+
+	InlineFunction(InlineFunction&) = delete;
+	void operator=(InlineFunction&) = delete;
+
+private:
+	typedef typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type Storage;
+
+	struct Ops{
+		R (*invoke)(void*, Args&&...);
+		/// Move constructs into dst and destroys src
+		void (*move)(void* dst, void* src);
+		void (*destroy)(void*);
+	};
+
+	template <class F>
+	struct InlineOps{
+		static R invoke(void* p, Args&&... args)
+		{
+			return (*static_cast<F*>(p))(std::forward<Args>(args)...);
+		}
+
+		static void move(void* dst, void* src)
+		{
+			new (dst) F(std::move(*static_cast<F*>(src)));
+			static_cast<F*>(src)->~F();
+		}
+
+		static void destroy(void* p)
+		{
+			static_cast<F*>(p)->~F();
+		}
+
+		static const Ops ops;
+	};
+
+	template <class F>
+	struct HeapOps{
+		static R invoke(void* p, Args&&... args)
+		{
+			return (**static_cast<F**>(p))(std::forward<Args>(args)...);
+		}
+
+		static void move(void* dst, void* src)
+		{
+			*static_cast<F**>(dst) = *static_cast<F**>(src);
+		}
+
+		static void destroy(void* p)
+		{
+			delete *static_cast<F**>(p);
+		}
+
+		static const Ops ops;
+	};
+
+	template <class F, class Func>
+	void construct(Func&& func, std::true_type)
+	{
+		new (&storage) F(std::forward<Func>(func));
+		ops = &InlineOps<F>::ops;
+	}
+
+	template <class F, class Func>
+	void construct(Func&& func, std::false_type)
+	{
+		*reinterpret_cast<F**>(&storage) = new F(std::forward<Func>(func));
+		ops = &HeapOps<F>::ops;
+	}
+
+	void reset()
+	{
+		if(ops){
+			ops->destroy(&storage);
+			ops = nullptr;
+		}
+	}
+
+	Storage storage;
+	const Ops* ops;
+};
+
+template <class R, class... Args, std::size_t INLINE_SIZE>
+template <class F>
+const typename InlineFunction<R(Args...), INLINE_SIZE>::Ops
+InlineFunction<R(Args...), INLINE_SIZE>::InlineOps<F>::ops = {&invoke, &move, &destroy};
+
+template <class R, class... Args, std::size_t INLINE_SIZE>
+template <class F>
+const typename InlineFunction<R(Args...), INLINE_SIZE>::Ops
+InlineFunction<R(Args...), INLINE_SIZE>::HeapOps<F>::ops = {&invoke, &move, &destroy};
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_INLINEFUNCTION_HPP_
@@ -2,7 +2,9 @@
 #define OTSERVPP_BASICINMESSAGE_HPP_
 
 #include <array>
+#include <cstring>
 #include "../networkdcl.hpp"
+#include "bufferpool.h"
 
 namespace otservpp {
 
@@ -10,29 +12,61 @@ namespace otservpp {
 class PacketException : public std::exception{};
 
 /*! Simple in-message for use in advanced message classes
- * The buffer is statically allocated, since most protocols use small buffers size this is OK.
+ * The first INLINE_SIZE bytes of the buffer are statically allocated, since most protocols use
+ * small buffers size this is OK. Messages whose header announces a bigger size borrow a buffer
+ * from the BufferPool, which is given back when the message is reset (i.e. after the message
+ * was dispatched and the next one is being received) or destroyed.
+ * By default the whole buffer is statically allocated.
  */
-template <unsigned int HEADER_SIZE, unsigned int MAX_BODY_SIZE>
+template <unsigned int HEADER_SIZE, unsigned int MAX_BODY_SIZE,
+		unsigned int INLINE_SIZE = HEADER_SIZE+MAX_BODY_SIZE>
 class BasicInMessage {
+	static_assert(INLINE_SIZE >= HEADER_SIZE, "the header must fit in the inline buffer");
+
 public:
-	typedef std::array<uint8_t, HEADER_SIZE+MAX_BODY_SIZE> Buffer;
+	typedef std::array<uint8_t, INLINE_SIZE> Buffer;
+
+	enum{
+		HeaderSize = HEADER_SIZE,
+		MaxSize = HEADER_SIZE + MAX_BODY_SIZE
+	};
 
 	BasicInMessage() :
 		pos(0),
 		size(HEADER_SIZE)
-	{}
+	{
+		data = inlineBuffer.data();
+	}
+
+	/// A borrowed buffer changes hands, otherwise only the received bytes are copied
+	BasicInMessage(BasicInMessage&& o) :
+		data(o.isPooled()? o.data : inlineBuffer.data()),
+		pos(o.pos),
+		size(o.size)
+	{
+		if(o.isPooled())
+			o.data = o.inlineBuffer.data();
+		else
+			std::memcpy(data, o.data, size);
+	}
 
-	BasicInMessage(BasicInMessage&&) = default;
+	/// Prepares the message for receiving a new header, giving back any pooled buffer
+	void reset()
+	{
+		releasePooledBuffer();
+		pos = 0;
+		size = HEADER_SIZE;
+	}
 
 	boost::asio::mutable_buffers_1  getHeaderBuffer()
 	{
-		return boost::asio::buffer(buffer.data(), HEADER_SIZE);
+		return boost::asio::buffer(data, HEADER_SIZE);
 	}
 
 	boost::asio::mutable_buffers_1 getBodyBuffer()
 	{
 		assert(size > HEADER_SIZE);
-		return boost::asio::buffer(buffer.data()+HEADER_SIZE, size-HEADER_SIZE);
+		return boost::asio::buffer(data+HEADER_SIZE, size-HEADER_SIZE);
 	}
 
 	/// Returns the total size of the message (header + body)
@@ -57,7 +91,7 @@ public:
 	uint8_t getByte()
 	{
 		movePos(1);
-		return buffer[pos-1];
+		return data[pos-1];
 	}
 
 	uint16_t getU16()
@@ -94,7 +128,10 @@ public:
 	void operator=(BasicInMessage&) = delete;
 
 protected:
-	~BasicInMessage() = default;
+	~BasicInMessage()
+	{
+		releasePooledBuffer();
+	}
 
 	template <class T>
 	typename std::enable_if<std::is_arithmetic<T>::value, T>::type
@@ -107,7 +144,7 @@ protected:
 	T* getRawChunckAs(unsigned int bytes)
 	{
 		movePos(bytes);
-		return reinterpret_cast<T*>(buffer.data() + (pos-bytes));
+		return reinterpret_cast<T*>(data + (pos-bytes));
 	}
 
 	void movePos(unsigned int bytes)
@@ -123,17 +160,38 @@ protected:
 		if(pos+bytes > size)
 			throw PacketException();
 		else
-			return reinterpret_cast<T*>(buffer.data() + pos);
+			return reinterpret_cast<T*>(data + pos);
 	}
 
 	void setRemainingSize(unsigned int bytes)
 	{
-		assert(pos+bytes <= MAX_BODY_SIZE);
+		assert(pos+bytes <= MaxSize);
+
+		if(pos+bytes > INLINE_SIZE && !isPooled()){
+			// keep what was already received, i.e. the header
+			data = BufferPool::instance().allocate(MaxSize);
+			std::memcpy(data, inlineBuffer.data(), size);
+		}
+
 		size = pos+bytes;
 	}
 
 private:
-	Buffer buffer;
+	bool isPooled() const
+	{
+		return data != inlineBuffer.data();
+	}
+
+	void releasePooledBuffer()
+	{
+		if(isPooled()){
+			BufferPool::instance().deallocate(data, MaxSize);
+			data = inlineBuffer.data();
+		}
+	}
+
+	Buffer inlineBuffer;
+	uint8_t* data;
 	unsigned int pos;
 	unsigned int size;
 };
@@ -2,34 +2,70 @@
 #define OTSERVPP_BASICOUTMESSAGE_HPP_
 
 #include <vector>
+#include <algorithm>
 #include <string>
 #include <cstring>
 #include <cassert>
 #include <boost/asio/buffer.hpp>
+#include "bufferpool.h"
 
 namespace otservpp{
 
-template <class Derived, int MAX_PREFIX_SIZE, int MAX_BUFFER_SIZE>
+/*! Growable outgoing message
+ * MAX_PREFIX_SIZE bytes are reserved in front of the body for prefixes (e.g. headers added
+ * after the body is known), and MAX_PADDING_SIZE bytes of capacity are kept after it, so
+ * neither prefixing nor padding the message when it's finished ever reallocates.
+ */
+template <class Derived, int MAX_PREFIX_SIZE, int MAX_BUFFER_SIZE, int MAX_PADDING_SIZE = 0>
 class BasicOutMessage{
 public:
-	typedef std::vector<uint8_t> BufferType;
+	/// Buffers are recycled through the BufferPool, they are given back as soon as the message
+	/// is destroyed (usually right after it's written to the socket)
+	typedef std::vector<uint8_t, PoolAllocator<uint8_t>> BufferType;
 
+	/// The capacity is rounded up to fill the whole pooled buffer
 	BasicOutMessage(unsigned int capacity) :
-		buffer(MAX_PREFIX_SIZE + capacity),
 		prefixPos(MAX_PREFIX_SIZE)
 	{
+		buffer.reserve(BufferPool::roundSize(MAX_PREFIX_SIZE + capacity + MAX_PADDING_SIZE));
 		buffer.resize(MAX_PREFIX_SIZE);
 	}
 
 	BasicOutMessage(const BasicOutMessage&) = default;
 	BasicOutMessage(BasicOutMessage&&) = default;
+	BasicOutMessage& operator=(const BasicOutMessage&) = default;
+	BasicOutMessage& operator=(BasicOutMessage&&) = default;
+
+	/// Marks the message as safe to discard when the connection it's sent through is congested
+	void setDroppable(bool droppable_ = true)
+	{
+		droppable = droppable_;
+	}
+
+	bool isDroppable() const
+	{
+		return droppable;
+	}
+
+	/*! Messages sharing the same non-zero key carry the same (e.g. creature position) update,
+	 * so a congested connection can replace a queued one with a newer one
+	 */
+	void setSupersedeKey(uint32_t key)
+	{
+		supersedeKey = key;
+	}
+
+	uint32_t getSupersedeKey() const
+	{
+		return supersedeKey;
+	}
 
 	boost::asio::const_buffers_1 getBuffer() const
 	{
 		return boost::asio::buffer(buffer.data()+prefixPos, buffer.size()-prefixPos);
 	}
 
-	std::size_t getSize()
+	std::size_t getSize() const
 	{
 		assert((int)buffer.size() >= prefixPos);
 		return buffer.size()-prefixPos;
@@ -45,6 +81,7 @@ public:
 
 	void addByte(uint8_t v)
 	{
+		reserveMore(1);
 		buffer.push_back(v);
 	}
 
@@ -95,9 +132,31 @@ public:
 
 	void addRaw(const char* raw, std::size_t size)
 	{
+		reserveMore(size);
 		buffer.insert(buffer.end(), (const uint8_t*)raw, (const uint8_t*)raw+size);
 	}
 
+	/*! Appends the contents (without prefixes) of another message
+	 * An empty message takes the flags of the first one added. After that the aggregate stays
+	 * droppable only while every part is, and keeps its supersede key only while every part
+	 * shares it, so a congested connection never discards or replaces an update it must send.
+	 */
+	void addMessage(const Derived& msg)
+	{
+		auto& other = static_cast<const BasicOutMessage&>(msg);
+		if(getSize() == 0){
+			droppable = other.droppable;
+			supersedeKey = other.supersedeKey;
+		} else {
+			droppable = droppable && other.droppable;
+			if(supersedeKey != other.supersedeKey)
+				supersedeKey = 0;
+		}
+
+		reserveMore(other.getSize());
+		buffer.insert(buffer.end(), other.buffer.begin() + other.prefixPos, other.buffer.end());
+	}
+
 	Derived& operator<<(uint8_t v)
 	{
 		add(v);
@@ -148,6 +207,7 @@ protected:
 	add(T value)
 	{
 		auto pos = buffer.size();
+		reserveMore(sizeof(T));
 		buffer.resize(pos+sizeof(T));
 		*reinterpret_cast<T*>(&buffer[pos]) = value;
 	}
@@ -155,14 +215,14 @@ protected:
 	void add(const std::string& str)
 	{
 		auto strSize = (uint16_t)str.size();
-		buffer.reserve(2+strSize);
+		reserveMore(2+strSize);
 		add(strSize);
 		buffer.insert(buffer.end(), str.cbegin(), str.cend());
 	}
 
 	void add(const char* str, uint16_t strSize)
 	{
-		buffer.reserve(2+strSize);
+		reserveMore(2+strSize);
 		add(strSize);
 		buffer.insert(buffer.end(), str, str+strSize);
 	}
@@ -172,8 +232,10 @@ protected:
 		add(str, strlen(str));
 	}
 
+	/// Padding up to MAX_PADDING_SIZE bytes never reallocates
 	void addPadding(std::size_t count, uint8_t value)
 	{
+		reserveMore(count > MAX_PADDING_SIZE? count - MAX_PADDING_SIZE : 0);
 		buffer.resize(buffer.size()+count, value);
 	}
 
@@ -185,6 +247,14 @@ protected:
 	}
 
 private:
+	/// Makes room for n more bytes plus the padding, growing by whole BufferPool size classes
+	void reserveMore(std::size_t n)
+	{
+		auto required = buffer.size() + n + MAX_PADDING_SIZE;
+		if(required > buffer.capacity())
+			buffer.reserve(BufferPool::roundSize(std::max(required, 2*buffer.capacity())));
+	}
+
 	Derived& derived()
 	{
 		return static_cast<Derived&>(*this);
@@ -192,6 +262,8 @@ private:
 
 	BufferType buffer;
 	int prefixPos;
+	uint32_t supersedeKey {0};
+	bool droppable {false};
 };
 
 } /* namespace otservpp */
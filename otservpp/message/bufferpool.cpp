@@ -0,0 +1,116 @@
+#include "bufferpool.h"
+
+namespace otservpp {
+
+const std::size_t BufferPool::classSizes[ClassCount] = {256, 1024, 4096, 16384, 32768};
+
+BufferPool& BufferPool::instance()
+{
+	static BufferPool pool;
+	return pool;
+}
+
+BufferPool::ThreadCache& BufferPool::threadCache()
+{
+	static thread_local ThreadCache cache;
+	return cache;
+}
+
+BufferPool::ThreadCache::~ThreadCache()
+{
+	for(std::size_t i = 0; i != ClassCount; ++i)
+		instance().spill(*this, i, sizes[i]);
+}
+
+std::size_t BufferPool::classOf(std::size_t size)
+{
+	std::size_t i = 0;
+	while(i != ClassCount && classSizes[i] < size)
+		++i;
+	return i;
+}
+
+std::size_t BufferPool::roundSize(std::size_t size)
+{
+	auto i = classOf(size);
+	return i != ClassCount? classSizes[i] : size;
+}
+
+uint8_t* BufferPool::allocate(std::size_t size)
+{
+	auto i = classOf(size);
+
+	if(i == ClassCount)
+		return new uint8_t[size];
+
+	auto& cache = threadCache();
+
+	if(!cache.heads[i])
+		refill(cache, i, TransferBatch);
+
+	if(auto buffer = cache.heads[i]){
+		cache.heads[i] = buffer->next;
+		--cache.sizes[i];
+		return reinterpret_cast<uint8_t*>(buffer);
+	}
+
+	return new uint8_t[classSizes[i]];
+}
+
+void BufferPool::deallocate(uint8_t* buffer, std::size_t size)
+{
+	auto i = classOf(size);
+
+	if(i == ClassCount){
+		delete[] buffer;
+		return;
+	}
+
+	auto& cache = threadCache();
+
+	if(cache.sizes[i] == MaxThreadFreeBuffers)
+		spill(cache, i, TransferBatch);
+
+	auto free = reinterpret_cast<FreeBuffer*>(buffer);
+	free->next = cache.heads[i];
+	cache.heads[i] = free;
+	++cache.sizes[i];
+}
+
+void BufferPool::refill(ThreadCache& cache, std::size_t i, std::size_t count)
+{
+	auto& list = freeLists[i];
+	std::lock_guard<std::mutex> lock(list.mutex);
+
+	for(; count != 0 && list.head; --count){
+		auto buffer = list.head;
+		list.head = buffer->next;
+		--list.size;
+
+		buffer->next = cache.heads[i];
+		cache.heads[i] = buffer;
+		++cache.sizes[i];
+	}
+}
+
+void BufferPool::spill(ThreadCache& cache, std::size_t i, std::size_t count)
+{
+	auto& list = freeLists[i];
+	std::lock_guard<std::mutex> lock(list.mutex);
+
+	for(; count != 0 && cache.heads[i]; --count){
+		auto buffer = cache.heads[i];
+		cache.heads[i] = buffer->next;
+		--cache.sizes[i];
+
+		if(list.size < MaxFreeBuffers){
+			buffer->next = list.head;
+			list.head = buffer;
+			++list.size;
+		} else {
+			delete[] reinterpret_cast<uint8_t*>(buffer);
+		}
+	}
+}
+
+} /* namespace otservpp */
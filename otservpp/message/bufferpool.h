@@ -0,0 +1,123 @@
+#ifndef OTSERVPP_BUFFERPOOL_H_
+#define OTSERVPP_BUFFERPOOL_H_
+
+#include <array>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+namespace otservpp {
+
+/*! Size-classed pool of raw byte buffers
+ * Requested sizes are rounded up to the smallest size class that fits them, released buffers
+ * are kept in a free list per size class (up to a limit) and handed out again on the next
+ * request of the same class. Sizes bigger than the largest class are simply new'd and deleted.
+ *
+ * Each thread keeps its own small free lists in front of the shared ones, so most requests
+ * don't need locking. Buffers flow in batches between both levels, this covers the usual case
+ * of buffers being allocated in one thread (e.g. game logic) and released in another (e.g.
+ * after being written to a socket).
+ *
+ * \note All the functions in this class are thread-safe
+ */
+class BufferPool{
+public:
+	enum{
+		ClassCount = 5,
+		/// Max number of idle buffers kept per size class
+		MaxFreeBuffers = 256,
+		/// Max number of idle buffers kept per size class in each thread
+		MaxThreadFreeBuffers = 32,
+		/// Number of buffers moved at once between the thread and the shared free lists
+		TransferBatch = MaxThreadFreeBuffers/2
+	};
+
+	/// Returns the process wide pool
+	static BufferPool& instance();
+
+	/// Returns the size of the class used for buffers of the given size
+	static std::size_t roundSize(std::size_t size);
+
+	/// Returns a buffer of at least size bytes
+	uint8_t* allocate(std::size_t size);
+
+	/// Returns a buffer obtained from allocate(size) to the pool
+	void deallocate(uint8_t* buffer, std::size_t size);
+
+private:
+	BufferPool() = default;
+
+	struct FreeBuffer{
+		FreeBuffer* next;
+	};
+
+	struct FreeList{
+		std::mutex mutex;
+		FreeBuffer* head {nullptr};
+		std::size_t size {0};
+	};
+
+	/// Per thread free lists, given back to the shared ones on thread exit
+	struct ThreadCache{
+		~ThreadCache();
+
+		std::array<FreeBuffer*, ClassCount> heads {{}};
+		std::array<std::size_t, ClassCount> sizes {{}};
+	};
+
+	static ThreadCache& threadCache();
+
+	/// Index of the size class of size, or ClassCount if it's too big
+	static std::size_t classOf(std::size_t size);
+
+	/// Moves up to count buffers of class i from the shared free list into the thread cache
+	void refill(ThreadCache& cache, std::size_t i, std::size_t count);
+
+	/// Moves count buffers of class i from the thread cache into the shared free list,
+	/// deleting the ones that don't fit
+	void spill(ThreadCache& cache, std::size_t i, std::size_t count);
+
+	static const std::size_t classSizes[ClassCount];
+
+	std::array<FreeList, ClassCount> freeLists;
+};
+
+/*! Standard allocator backed by the BufferPool
+ * Used for the buffers of outgoing messages and the control blocks of scheduler tasks, which
+ * are allocated and released all the time.
+ */
+template <class T>
+struct PoolAllocator{
+	typedef T value_type;
+
+	PoolAllocator() = default;
+
+	template <class U>
+	PoolAllocator(const PoolAllocator<U>&){}
+
+	T* allocate(std::size_t n)
+	{
+		return reinterpret_cast<T*>(BufferPool::instance().allocate(n*sizeof(T)));
+	}
+
+	void deallocate(T* p, std::size_t n)
+	{
+		BufferPool::instance().deallocate(reinterpret_cast<uint8_t*>(p), n*sizeof(T));
+	}
+};
+
+template <class T, class U>
+inline bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&)
+{
+	return true;
+}
+
+template <class T, class U>
+inline bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&)
+{
+	return false;
+}
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_BUFFERPOOL_H_
@@ -0,0 +1,162 @@
+#ifndef OTSERVPP_RINGBUFFER_HPP_
+#define OTSERVPP_RINGBUFFER_HPP_
+
+#include <array>
+#include <cstring>
+#include <cassert>
+#include <boost/asio/buffer.hpp>
+#include "bufferpool.h"
+
+namespace otservpp {
+
+/*! Fixed size byte FIFO used for buffering raw data coming from a socket
+ * Free space is exposed as a (possibly split) buffer sequence suitable for async_read_some,
+ * while buffered data is extracted with peek(), read() and consume(). CAPACITY must be a power
+ * of 2.
+ *
+ * The storage is borrowed from the BufferPool by prepare() and can be given back with
+ * release() once the buffer is empty, so an idle owner only pays for a few words.
+ */
+template <std::size_t CAPACITY>
+class RingBuffer{
+	static_assert((CAPACITY & (CAPACITY-1)) == 0, "RingBuffer capacity must be a power of 2");
+
+public:
+	typedef std::array<boost::asio::mutable_buffer, 2> MutableBuffers;
+
+	enum{ Capacity = CAPACITY };
+
+	RingBuffer() = default;
+
+	~RingBuffer()
+	{
+		if(buffer)
+			BufferPool::instance().deallocate(buffer, CAPACITY);
+	}
+
+	RingBuffer(const RingBuffer&) = delete;
+	RingBuffer& operator=(const RingBuffer&) = delete;
+
+	/// Number of buffered bytes
+	std::size_t size() const
+	{
+		return tail - head;
+	}
+
+	/// Number of bytes that can still be written into the buffer
+	std::size_t available() const
+	{
+		return CAPACITY - size();
+	}
+
+	bool empty() const
+	{
+		return head == tail;
+	}
+
+	/// Whether the storage is currently borrowed from the BufferPool
+	bool hasStorage() const
+	{
+		return buffer != nullptr;
+	}
+
+	/// Gives the storage back to the BufferPool, the buffer must be empty
+	void release()
+	{
+		assert(empty());
+
+		if(buffer){
+			BufferPool::instance().deallocate(buffer, CAPACITY);
+			buffer = nullptr;
+		}
+	}
+
+	/*! Returns the free space of the buffer, borrowing the storage if needed
+	 * After writing into the returned buffers commit() must be called with the number of
+	 * bytes written.
+	 */
+	MutableBuffers prepare()
+	{
+		if(!buffer)
+			buffer = BufferPool::instance().allocate(CAPACITY);
+
+		// start from the beginning whenever possible, so a read doesn't get split
+		if(empty())
+			head = tail = 0;
+
+		auto start = mask(tail);
+		auto free = available();
+		auto first = std::min(free, CAPACITY - start);
+
+		return {{boost::asio::buffer(buffer + start, first),
+				 boost::asio::buffer(buffer, free - first)}};
+	}
+
+	/// Makes bytes written into the buffers returned by prepare() available for reading
+	void commit(std::size_t bytes)
+	{
+		assert(bytes <= available());
+		tail += bytes;
+	}
+
+	/// Copies the first buffer_size(dst) buffered bytes into dst without consuming them
+	void peek(const boost::asio::mutable_buffer& dst) const
+	{
+		auto bytes = boost::asio::buffer_size(dst);
+		auto out = boost::asio::buffer_cast<uint8_t*>(dst);
+		assert(bytes <= size());
+
+		auto start = mask(head);
+		auto first = std::min(bytes, CAPACITY - start);
+
+		std::memcpy(out, buffer + start, first);
+		std::memcpy(out + first, buffer, bytes - first);
+	}
+
+	/// Copies the first buffer_size(dst) buffered bytes into dst and consumes them
+	void read(const boost::asio::mutable_buffer& dst)
+	{
+		peek(dst);
+		consume(boost::asio::buffer_size(dst));
+	}
+
+	/// Discards the first bytes of the buffered data
+	void consume(std::size_t bytes)
+	{
+		assert(bytes <= size());
+		head += bytes;
+	}
+
+	/// Moves every byte buffered in other to the end of this buffer, other's storage is released
+	template <std::size_t OTHER_CAPACITY>
+	void takeFrom(RingBuffer<OTHER_CAPACITY>& other)
+	{
+		if(other.empty())
+			return other.release();
+
+		auto bytes = other.size();
+		assert(bytes <= available());
+
+		auto free = prepare();
+		auto first = std::min(bytes, boost::asio::buffer_size(free[0]));
+
+		other.read(boost::asio::buffer(free[0], first));
+		other.read(boost::asio::buffer(free[1], bytes - first));
+		other.release();
+		commit(bytes);
+	}
+
+private:
+	static std::size_t mask(std::size_t pos)
+	{
+		return pos & (CAPACITY-1);
+	}
+
+	uint8_t* buffer {nullptr};
+	std::size_t head {0};
+	std::size_t tail {0};
+};
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_RINGBUFFER_HPP_
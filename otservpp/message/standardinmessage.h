@@ -10,12 +10,15 @@ namespace otservpp {
 // TODO 15340 is taken from otserv, is this an arbitrary constant?
 enum{
 	STANDARD_IN_MESSAGE_HEADER_SIZE = 2,
-	STANDARD_IN_MESSAGE_MAX_BODY_SIZE = 15340
+	STANDARD_IN_MESSAGE_MAX_BODY_SIZE = 15340,
+	/// Bigger packets (quite rare) use a pooled buffer
+	STANDARD_IN_MESSAGE_INLINE_SIZE = 256
 };
 
 /// Standard incoming tibia packet.
 class StandardInMessage :
-	public BasicInMessage<STANDARD_IN_MESSAGE_HEADER_SIZE, STANDARD_IN_MESSAGE_MAX_BODY_SIZE>{
+	public BasicInMessage<STANDARD_IN_MESSAGE_HEADER_SIZE, STANDARD_IN_MESSAGE_MAX_BODY_SIZE,
+		STANDARD_IN_MESSAGE_INLINE_SIZE>{
 public:
 	StandardInMessage();
 
@@ -14,10 +14,38 @@ void StandardOutMessage::xteaEncrypt(const crypto::Xtea& xtea)
 	xtea.encrypt(getBufferAs<uint32_t>(), getSize());
 }
 
+void StandardOutMessage::finalize(const crypto::Xtea& xtea)
+{
+	// big enough for the SIMD XTEA passes, small enough to stay in L1 for the checksum
+	enum{ ChunkSize = 512 };
+
+	addHeader();
+	addPadding(8 - getSize()%8, 0x33);
+
+	auto data = getBufferAs<uint8_t>();
+	std::size_t size = getSize();
+	uint32_t checksum = 1;
+
+	for(std::size_t pos = 0; pos < size; pos += ChunkSize){
+		std::size_t chunk = std::min<std::size_t>(ChunkSize, size - pos);
+		xtea.encrypt(reinterpret_cast<uint32_t*>(data + pos), chunk);
+		checksum = crypto::adler32(checksum, data + pos, chunk);
+	}
+
+	addPrefix(checksum);
+	addPrefix((uint16_t)getSize());
+}
+
 void StandardOutMessage::encode()
 {
+	if(encryptOnEncode){
+		encryptOnEncode = false;
+		finalize(xtea);
+		return;
+	}
+
 	addPrefix(crypto::adler32(getBufferAs<uint8_t>(), (int32_t)getSize()));
-	addPrefix(getSize());
+	addPrefix((uint16_t)getSize());
 }
 
 } /* namespace otservpp */
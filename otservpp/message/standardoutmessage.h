@@ -3,6 +3,7 @@
 
 #include "basicoutmessage.hpp"
 #include "../forwarddcl.hpp"
+#include "../crypto.h"
 
 namespace otservpp {
 
@@ -10,24 +11,29 @@ enum{
 	/// RawPacketLen(2) + Adler32(4) + DecryptedPacketLen(2)
 	STANDARD_OUT_MESSAGE_PREFIX_SIZE = 8,
 	STANDARD_OUT_MESSAGE_MAX_SIZE = 20000,
+	/// XTEA works on 8 byte blocks
+	STANDARD_OUT_MESSAGE_PADDING_SIZE = 8,
+	/// Fits prefix, body and XTEA padding into the 1KB class of the BufferPool
+	STANDARD_OUT_MESSAGE_INITIAL_SIZE = 1024 - STANDARD_OUT_MESSAGE_PREFIX_SIZE -
+		STANDARD_OUT_MESSAGE_PADDING_SIZE
 };
 
 class StandardOutMessage :
-	public BasicOutMessage<StandardOutMessage,
-		STANDARD_OUT_MESSAGE_PREFIX_SIZE, STANDARD_OUT_MESSAGE_MAX_SIZE>
+	public BasicOutMessage<StandardOutMessage, STANDARD_OUT_MESSAGE_PREFIX_SIZE,
+		STANDARD_OUT_MESSAGE_MAX_SIZE, STANDARD_OUT_MESSAGE_PADDING_SIZE>
 {
 public:
-	typedef BasicOutMessage<StandardOutMessage,
-			STANDARD_OUT_MESSAGE_PREFIX_SIZE, STANDARD_OUT_MESSAGE_MAX_SIZE> BasicOutMsg;
+	typedef BasicOutMessage<StandardOutMessage, STANDARD_OUT_MESSAGE_PREFIX_SIZE,
+		STANDARD_OUT_MESSAGE_MAX_SIZE, STANDARD_OUT_MESSAGE_PADDING_SIZE> BasicOutMsg;
 
 	///  Created a StandardOutMessage with a reasonable initial buffer
 	StandardOutMessage() :
-		BasicOutMsg(1024)
+		BasicOutMsg(STANDARD_OUT_MESSAGE_INITIAL_SIZE)
 	{}
 
 	/// Shorthand for \code StandardOutMessage msg; msg.addByte(packetType); \endcode
 	explicit StandardOutMessage(uint8_t packetType) :
-		BasicOutMsg(1024)
+		BasicOutMsg(STANDARD_OUT_MESSAGE_INITIAL_SIZE)
 	{
 		add(packetType);
 	}
@@ -49,11 +55,31 @@ public:
 	/// Encrypts the message using the given XTEA structure
 	void xteaEncrypt(const crypto::Xtea& xtea);
 
+	/*! Adds the header, pads and encrypts the message, then adds the checksum and size
+	 * prefixes. The checksum is computed as each chunk of ciphertext is produced, while it's
+	 * still in cache, instead of re-reading the whole message afterwards. After calling this
+	 * the message is ready to be written, and encode() must not be called.
+	 */
+	void finalize(const crypto::Xtea& xtea);
+
+	/*! Makes encode() finalize() the message with the given XTEA structure
+	 * This way the encryption cost is paid by the I/O thread sending the message instead of
+	 * the one that created it. No more data should be added after encode() is called.
+	 */
+	void deferXteaEncrypt(const crypto::Xtea& xtea_)
+	{
+		xtea = xtea_;
+		encryptOnEncode = true;
+	}
+
 	/// Called by otservpp::Connection before actually sending the packet, we do some defered
 	/// packaging here
 	void encode();
 
 private:
+	crypto::Xtea xtea;
+	bool encryptOnEncode {false};
+
 	template <class... Args>
 	uint16_t calculateSize(Args&... args)
 	{
@@ -0,0 +1,88 @@
+#ifndef OTSERVPP_MPSCQUEUE_HPP_
+#define OTSERVPP_MPSCQUEUE_HPP_
+
+#include <atomic>
+
+namespace otservpp {
+
+/*! Intrusive lock-free multi-producer single-consumer FIFO
+ * This is Dmitry Vyukov's node based MPSC queue. Node types must derive from
+ * MpscQueue<Node>::Hook, the queue never allocates nor frees nodes.
+ *
+ * push() is wait-free and can be called from any thread, pop() must only be called by one
+ * thread at a time (e.g. from a strand). pop() may return nullptr while a push() is in
+ * progress, even if the pushed node was linked before other ones; clients that need to know
+ * exactly when the queue is empty should keep a separated counter.
+ */
+template <class Node>
+class MpscQueue{
+public:
+	struct Hook{
+		std::atomic<Hook*> next {nullptr};
+	};
+
+	MpscQueue() :
+		head(&stub),
+		tail(&stub)
+	{}
+
+	/// Links the given node at the end of the queue
+	/// \note This function is thread-safe
+	void push(Node* node)
+	{
+		push(static_cast<Hook*>(node));
+	}
+
+	/// Unlinks the node at the beginning of the queue, returns nullptr if there's none
+	Node* pop()
+	{
+		Hook* first = tail;
+		Hook* next = first->next.load(std::memory_order_acquire);
+
+		if(first == &stub){
+			if(!next)
+				return nullptr;
+
+			tail = first = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+
+		if(next){
+			tail = next;
+			return static_cast<Node*>(first);
+		}
+
+		// a producer is linking a new node
+		if(first != head.load(std::memory_order_acquire))
+			return nullptr;
+
+		push(&stub);
+
+		next = first->next.load(std::memory_order_acquire);
+		if(next){
+			tail = next;
+			return static_cast<Node*>(first);
+		}
+
+		return nullptr;
+	}
+
+	MpscQueue(MpscQueue&) = delete;
+	void operator=(MpscQueue&) = delete;
+
+private:
+	void push(Hook* hook)
+	{
+		hook->next.store(nullptr, std::memory_order_relaxed);
+		Hook* prev = head.exchange(hook, std::memory_order_acq_rel);
+		prev->next.store(hook, std::memory_order_release);
+	}
+
+	Hook stub;
+	std::atomic<Hook*> head;
+	Hook* tail;
+};
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_MPSCQUEUE_HPP_
@@ -0,0 +1,139 @@
+#ifndef OTSERVPP_PARALLELFOR_HPP_
+#define OTSERVPP_PARALLELFOR_HPP_
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <exception>
+#include <functional>
+#include <algorithm>
+#include "networkdcl.hpp"
+
+namespace otservpp {
+
+/*! A parallelFor in progress, see parallelFor()
+ * Every chunk of the range is a task in the pool. A chunk splits off its upper half as a new
+ * task while the pool has less queued tasks than workers, i.e. while somebody may be idle,
+ * otherwise it runs grain indices and checks again. This way the range is cut in as many
+ * pieces as the load asks for, not in a fixed number of them, and nested loops don't flood
+ * the pool.
+ *
+ * Pool is either a WorkStealingPool or the Scheduler's ParallelExecutionService.
+ */
+template <class Pool, class Func, class Callback>
+class ParallelLoop{
+public:
+	typedef std::shared_ptr<ParallelLoop> Ptr;
+
+	ParallelLoop(Pool& pool_, boost::asio::io_service& ioService_, std::size_t count,
+			std::size_t grain_, Func&& fn_, Callback&& onDone_) :
+		pool(pool_),
+		ioService(ioService_),
+		work(ioService_),
+		left(count),
+		grain(std::max<std::size_t>(grain_, 1)),
+		fn(std::move(fn_)),
+		onDone(std::move(onDone_))
+	{}
+
+	/// Queues a task running [begin, end)
+	static void spawn(const Ptr& loop, std::size_t begin, std::size_t end)
+	{
+		loop->pool.post([loop, begin, end]{ loop->run(loop, begin, end); });
+	}
+
+	ParallelLoop(ParallelLoop&) = delete;
+	void operator=(ParallelLoop&) = delete;
+
+private:
+	void run(const Ptr& self, std::size_t begin, std::size_t end)
+	{
+		auto first = begin;
+		try{
+			while(end - begin > grain && !failed){
+				if(pool.queued() < pool.size()){
+					auto middle = begin + (end-begin)/2;
+					spawn(self, middle, end);
+					end = middle;
+				} else {
+					for(auto stop = begin + grain; begin < stop; ++begin)
+						fn(begin);
+				}
+			}
+
+			for(; begin < end && !failed; ++begin)
+				fn(begin);
+		} catch(...){
+			if(!failed.exchange(true))
+				error = std::current_exception();
+		}
+
+		finish(end - first);
+	}
+
+	/// Accounts n indices as done, the last chunk posts the completion
+	void finish(std::size_t n)
+	{
+		if(left.fetch_sub(n) != n)
+			return;
+
+		if(error){
+			auto e = error;
+			ioService.post([e]{ std::rethrow_exception(e); });
+		} else {
+			ioService.post(std::move(onDone));
+		}
+	}
+
+	Pool& pool;
+	boost::asio::io_service& ioService;
+	/// The io_service doesn't run out of work while the loop is running
+	boost::asio::io_service::work work;
+	std::atomic<std::size_t> left;
+	const std::size_t grain;
+	std::atomic<bool> failed {false};
+	std::exception_ptr error;
+	Func fn;
+	Callback onDone;
+};
+
+/*! Calls fn(i) for every i in [begin, end) in the workers of pool, then onDone in ioService
+ * The range is chunked adaptively, grain is the smallest chunk worth a task of its own (e.g.
+ * 1 for pathfinding, a few hundreds for cheap checks). The order of the calls is unspecified.
+ *
+ * If fn throws, the indices not yet started are skipped and the first exception is rethrown
+ * from ioService instead of calling onDone.
+ */
+template <class Pool, class Func, class Callback>
+void parallelFor(Pool& pool, boost::asio::io_service& ioService, std::size_t begin,
+		std::size_t end, std::size_t grain, Func&& fn, Callback&& onDone)
+{
+	typedef ParallelLoop<Pool, typename std::decay<Func>::type,
+			typename std::decay<Callback>::type> Loop;
+
+	if(begin >= end){
+		ioService.post(std::forward<Callback>(onDone));
+		return;
+	}
+
+	auto loop = std::make_shared<Loop>(pool, ioService, end-begin, grain,
+			typename std::decay<Func>::type(std::forward<Func>(fn)),
+			typename std::decay<Callback>::type(std::forward<Callback>(onDone)));
+	Loop::spawn(loop, begin, end);
+}
+
+/*! Runs every task in the workers of pool, then onDone in ioService
+ * Exceptions are handled as in parallelFor().
+ */
+template <class Pool, class Callback>
+void whenAll(Pool& pool, boost::asio::io_service& ioService,
+		std::vector<std::function<void()>> tasks, Callback&& onDone)
+{
+	auto shared = std::make_shared<std::vector<std::function<void()>>>(std::move(tasks));
+	parallelFor(pool, ioService, 0, shared->size(), 1,
+			[shared](std::size_t i){ (*shared)[i](); }, std::forward<Callback>(onDone));
+}
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_PARALLELFOR_HPP_
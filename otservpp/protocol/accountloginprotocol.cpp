@@ -63,7 +63,7 @@ void AccountLoginProtocol::sendCharacterList(AccountPtr& account)
 				<< get<CharacterPort>(it);
 		}
 
-		sendAndStop(out);
+		sendAndStop(std::move(out));
 	}
 }
 
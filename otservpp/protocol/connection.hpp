@@ -2,14 +2,45 @@
 #define OTSERVPP_CONNECTION_HPP_
 
 #include <deque>
+#include <atomic>
+#include <vector>
+#include <algorithm>
 #include <glog/logging.h>
 #include "../forwarddcl.hpp"
 #include "../networkdcl.hpp"
 #include "traits.hpp"
+#include "timeoutservice.h"
+#include "outputlimits.h"
+#include "../service/reactorpool.h"
+#include "../mpscqueue.hpp"
+#include "../message/ringbuffer.hpp"
+#include "../message/bufferpool.h"
 #include <bitset>
 
 namespace otservpp{
 
+namespace detail{
+
+// help us to switch protocols at runtime, it doesn't depend on the protocol so it can be
+// handed over between connections
+struct ConnectionImpl{
+	ConnectionImpl(boost::asio::io_service& ioSvc, boost::asio::ip::tcp::socket&& socket) :
+		peer(std::move(socket)),
+		strand(ioSvc),
+		readTimeout(ioSvc),
+		writeTimeout(ioSvc),
+		loadToken(ioSvc)
+	{}
+
+	boost::asio::ip::tcp::socket peer;
+	boost::asio::strand strand;
+	TimeoutService::Entry readTimeout;
+	TimeoutService::Entry writeTimeout;
+	ReactorLoad::Token loadToken;
+};
+
+} /* namespace detail */
+
 /*! Represents a connection with a remote peer.
  * The connection class takes care of managing the underlying message transmission from and to
  * a remote peer. This is independent from the message interpreter (i.e. protocol) used.
@@ -27,20 +58,7 @@ namespace otservpp{
 template <class Protocol>
 class Connection : public std::enable_shared_from_this<Connection<Protocol> > {
 
-	// help us to switch protocols at runtime
-	struct ConnectionImpl{
-		ConnectionImpl(boost::asio::io_service& ioSvc, boost::asio::ip::tcp::socket&& socket) :
-			peer(std::move(socket)),
-			strand(ioSvc),
-			readTimer(ioSvc),
-			writeTimer(ioSvc)
-		{}
-
-		boost::asio::ip::tcp::socket peer;
-		boost::asio::strand strand;
-		boost::asio::deadline_timer readTimer;
-		boost::asio::deadline_timer writeTimer;
-	};
+	typedef detail::ConnectionImpl ConnectionImpl;
 
 	// connection state
 	enum{
@@ -57,13 +75,15 @@ public:
 
 	enum{
 		ReadTimeOut  = TypeTraits::ReadTimeOut,
-		WriteTimeOut = TypeTraits::WriteTimeOut
+		WriteTimeOut = TypeTraits::WriteTimeOut,
+		GatherWrites = TypeTraits::GatherWrites,
+		ReadBufferSize = TypeTraits::ReadBufferSize
 	};
 
 	/*! Creates a connection with the given socket representing the remote peer
-	 * \note Asio sockets can't be ioservice re-parented, this could cause problems if we want
-	 * to change the connection multiplexing thread, at the moment we don't do that (and it's
-	 * probably we'll never do that anyway)
+	 * The connection runs in the socket's io_service. Asio sockets can't be re-parented, so
+	 * ServiceManager moves the descriptor of an accepted peer to a socket of the chosen
+	 * reactor (see ServiceManager::handOff()) before the connection is created.
 	 */
 	Connection(boost::asio::ip::tcp::socket&& socket) :
 		impl(new ConnectionImpl(socket.get_io_service(), std::move(socket)))
@@ -81,7 +101,8 @@ public:
 	 * After returning from this function the old connection is unusable. To start receiving
 	 * data from the remote peer Connection::start() must be called on the new connection,
 	 * as normally Protocol::handleFirstMessage() will be called when receiving the first
-	 * message
+	 * message. Data the old connection already read past its last message is carried over,
+	 * and is dispatched by start() before reading from the peer again.
 	 */
 	template <class OldProtocol>
 	Connection(Connection<OldProtocol>&& old) :
@@ -89,26 +110,29 @@ public:
 	{
 		assert(old.outMsgQueue.empty());
 		assert(!old.isStopped());
+		assert(ReadBufferSize != 0 || old.inBuffer.empty());
 
 		DLOG(INFO) << "switching protocol from" << old.protocol->getName() << logInfo();
 
+		inBuffer.takeFrom(old.inBuffer);
+
 		// after returning from OldProtocol::handle[First]Message 'isStopped()' must return
 		// true, we can't use old.stop() since it closes the socket
 		old.closeStatus = ReadClosed | WriteClosed;
 
-		impl->readTimer.cancel(); // canceling doesn't change deadline
-		waitOnReadTimer(); // same handler different 'this'
-
-		impl->writeTimer.cancel();
-		waitOnWriteTimer();
-
-		start();
+		// timeouts keep running, but their handlers point to the old connection, which has no
+		// impl anymore. Until start() binds them to this one, expiring does nothing
+		impl->readTimeout.setHandler(nullptr);
+		impl->writeTimeout.setHandler(nullptr);
 	}
 
 	/// The connection is destroyed whenever an error occurs or a call to close() is made
 	~Connection()
 	{
 		assert(isStopped());
+
+		while(auto node = sendQueue.pop())
+			delete node;
 	}
 
 	/// Starts listening for incoming data passing all completed messages to the given protocol
@@ -116,7 +140,21 @@ public:
 	{
 		protocol = p;
 		DVLOG(1) << "starting reading" << logInfo();
-		parseIncomingMessage<ProtocolFirstMessageHandler>();
+
+		watchTimeouts();
+
+		if(ReadBufferSize == 0){
+			parseIncomingMessage<ProtocolFirstMessageHandler>();
+		} else if(inBuffer.empty()){
+			dispatchIncomingStream<ProtocolFirstMessageHandler>();
+		} else {
+			// data carried over from a protocol switch, wait for the old protocol to return
+			auto sthis = shared_from_this();
+			impl->strand.post([this, sthis]{
+				if(this->isReceiving())
+					this->dispatchIncomingStream<ProtocolFirstMessageHandler>();
+			});
+		}
 	}
 
 	/// Closes the connection, stops any pending IO operation and resets the protocol ptr
@@ -126,15 +164,14 @@ public:
 		impl->strand.dispatch([this]{
 			closeStatus = ReadClosed | WriteClosed;
 			VLOG(1) << "stopping connection" << this->logInfo();
-			impl->readTimer.cancel();
-			impl->writeTimer.cancel();
+			impl->readTimeout.cancel();
+			impl->writeTimeout.cancel();
 			impl->peer.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
 			impl->peer.close();
 			protocol.reset();
 		});
 	}
 
-	/// TODO decide if atomic closeStatus is worth it
 	void stopReceiving()
 	{
 		closeStatus |= ReadClosed;
@@ -159,6 +196,8 @@ public:
 
 	/*! Checks whether a connection is stopped
 	 * A connection is stopped when it ain't receiving nor sending data.
+	 * \note This function is thread-safe, e.g. the game thread checks it before handling
+	 * messages posted from the strand
 	 */
 	bool isStopped()
 	{
@@ -170,6 +209,33 @@ public:
 		return !isStopped() && impl->peer.is_open();
 	}
 
+	/*! Replaces the output limits, which default to the ones given by TypeTraits
+	 * \note This functions is thread-safe
+	 */
+	void setOutputLimits(const OutputLimits& limits)
+	{
+		auto sthis = shared_from_this();
+		impl->strand.dispatch([this, sthis, limits]{
+			outputLimits = limits;
+			outputPressure.add(0, outputLimits);
+		});
+	}
+
+	/// Number of connections, of any protocol, with more queued bytes than their soft limit
+	static std::size_t congestedConnections()
+	{
+		return OutputPressure::congestedConnections();
+	}
+
+	/*! Runs handler in the connection's strand, never from inside this call
+	 * \note This function is thread-safe
+	 */
+	template <class Handler>
+	void post(Handler&& handler)
+	{
+		impl->strand.post(std::forward<Handler>(handler));
+	}
+
 	/// Returns the peers IP address
 	boost::asio::ip::address getPeerAddress()
 	{
@@ -186,15 +252,24 @@ public:
 	template <class Message>
 	void send(Message&& msg)
 	{
-		trySendOrEnqueueThen(std::forward<Message>(msg), [this]{ this->keepSending(); });
+		trySendOrEnqueue(std::forward<Message>(msg), false);
 	}
 
-	/// Same as send(Message&& msg) but stops the connection when finished
-	/// \note This functions is thread-safe
+	/*! Same as send(Message&& msg) but stops the connection when finished
+	 * Every message queued before this one is sent too, messages queued afterwards are dropped.
+	 * \note This functions is thread-safe
+	 */
 	template <class Message>
 	void sendAndStop(Message&& msg)
 	{
-		trySendOrEnqueueThen(std::forward<Message>(msg), [this]{ this->stop(); });
+		trySendOrEnqueue(std::forward<Message>(msg), true);
+	}
+
+	/// Returns the current protocol, must be called from the connection's strand (e.g. from
+	/// a protocol handler)
+	const ProtocolPtr& getProtocol() const
+	{
+		return protocol;
 	}
 
 	std::string logInfo()
@@ -214,6 +289,9 @@ public:
 	void operator=(Connection&) = delete;
 
 private:
+	// protocol switching moves state between connections
+	template <class> friend class Connection;
+
 	using std::enable_shared_from_this<Connection>::shared_from_this;
 
 	/// Helper for dispatching the first messages to the protocol
@@ -236,6 +314,7 @@ private:
 		updateReadTimer();
 
 		auto sthis = shared_from_this();
+		inMsg.reset();
 
 		// strand wrapping is in asyncRead
 		asyncRead(inMsg.getHeaderBuffer(), [=](){
@@ -243,19 +322,7 @@ private:
 
 			try{
 				this->asyncRead(inMsg.parseHeaderAndGetBodyBuffer(), [=](){
-					impl->readTimer.cancel();
-
-					DVLOG(1) << "dispatching " << inMsg << this->logInfo();
-
-					try{
-						ProtocolHandler::sendInMsg(this);
-					}catch(std::exception& e){
-						LOG(ERROR) << "unexpected exception caught" << this->droppingLogInfo()
-									<< ". What: " << e.what();
-						return this->abort();
-					}
-
-					if(this->isReceiving())
+					if(this->dispatchMessage<ProtocolHandler>() && this->isReceiving())
 						this->parseIncomingMessage<ProtocolMessageHandler>();
 				});
 			} catch(std::exception&){
@@ -265,6 +332,179 @@ private:
 		});
 	}
 
+	/// Passes inMsg to the protocol, returns false if the connection was aborted
+	template <class ProtocolHandler>
+	bool dispatchMessage()
+	{
+		impl->readTimeout.cancel();
+
+		DVLOG(1) << "dispatching " << inMsg << this->logInfo();
+
+		try{
+			ProtocolHandler::sendInMsg(this);
+		}catch(std::exception& e){
+			LOG(ERROR) << "unexpected exception caught" << this->droppingLogInfo()
+						<< ". What: " << e.what();
+			this->abort();
+			return false;
+		}
+
+		return true;
+	}
+
+	/*! Dispatches every complete message found in inBuffer, then keeps reading
+	 * This is the streaming counterpart of parseIncomingMessage(), used when
+	 * TypeTraits::ReadBufferSize is set.
+	 */
+	template <class ProtocolHandler>
+	void dispatchIncomingStream()
+	{
+		if(!dispatchBufferedMessage<ProtocolHandler>())
+			return;
+
+		while(isReceiving())
+			if(!dispatchBufferedMessage<ProtocolMessageHandler>())
+				return;
+	}
+
+	/*! Dispatches the next message buffered in inBuffer
+	 * If there isn't a complete message buffered a new read is started. Returns true if a
+	 * message was dispatched and the connection wasn't aborted.
+	 */
+	template <class ProtocolHandler>
+	bool dispatchBufferedMessage()
+	{
+		std::size_t bufferedBody = 0;
+		Extraction result;
+
+		try{
+			result = extractBufferedMessage(bufferedBody);
+		} catch(std::exception&){
+			LOG(INFO) << "invalid packet header" << droppingLogInfo();
+			this->abort();
+			return false;
+		}
+
+		switch(result){
+		case Extraction::Complete:
+			return dispatchMessage<ProtocolHandler>();
+
+		case Extraction::Incomplete:
+			if(inBuffer.empty())
+				waitIncomingStream<ProtocolHandler>();
+			else
+				readIncomingStream<ProtocolHandler>();
+			return false;
+
+		case Extraction::TooLarge:
+			readLargeMessage<ProtocolHandler>(bufferedBody);
+			return false;
+		}
+
+		return false;
+	}
+
+	enum class Extraction{ Complete, Incomplete, TooLarge };
+
+	/*! Moves the next complete message from inBuffer into inMsg
+	 * Throws on invalid headers. If the message can't fit in inBuffer, the buffered part
+	 * of its body is moved into inMsg anyway, bufferedBody is set to its size and TooLarge
+	 * is returned.
+	 */
+	Extraction extractBufferedMessage(std::size_t& bufferedBody)
+	{
+		inMsg.reset();
+
+		auto header = inMsg.getHeaderBuffer();
+		auto headerSize = boost::asio::buffer_size(header);
+
+		if(inBuffer.size() < headerSize)
+			return Extraction::Incomplete;
+
+		inBuffer.peek(header);
+
+		auto body = inMsg.parseHeaderAndGetBodyBuffer();
+		auto bodySize = boost::asio::buffer_size(body);
+		bufferedBody = inBuffer.size() - headerSize;
+
+		if(bufferedBody >= bodySize){
+			inBuffer.consume(headerSize);
+			inBuffer.read(body);
+			return Extraction::Complete;
+		}
+
+		if(headerSize + bodySize > inBuffer.Capacity){
+			inBuffer.consume(headerSize);
+			inBuffer.read(boost::asio::buffer(body, bufferedBody));
+			return Extraction::TooLarge;
+		}
+
+		return Extraction::Incomplete;
+	}
+
+	/*! Waits for the remote peer to send something without holding any buffer
+	 * inBuffer gives its storage back to the BufferPool while the connection is idle, it's
+	 * borrowed again by readIncomingStream() once there's data to read.
+	 */
+	template <class ProtocolHandler>
+	void waitIncomingStream()
+	{
+		updateReadTimer();
+		inBuffer.release();
+
+		auto sthis = shared_from_this();
+
+		impl->peer.async_read_some(boost::asio::null_buffers(), impl->strand.wrap(
+		[this, sthis](const boost::system::error_code& e, std::size_t){
+			if(!e){
+				if(this->isReceiving())
+					this->readIncomingStream<ProtocolHandler>();
+			} else {
+				VLOG_IF(1, e != boost::asio::error::operation_aborted) << "read error "
+						<< e << " while waiting for data" << this->logInfo();
+				this->abort(e);
+			}
+		}));
+	}
+
+	/// Reads whatever the remote peer has sent into inBuffer
+	template <class ProtocolHandler>
+	void readIncomingStream()
+	{
+		updateReadTimer();
+
+		auto sthis = shared_from_this();
+
+		impl->peer.async_read_some(inBuffer.prepare(), impl->strand.wrap(
+		[this, sthis](const boost::system::error_code& e, std::size_t bytesRead){
+			if(!e){
+				if(!this->isReceiving()) return;
+
+				DVLOG(1) << bytesRead << " bytes read" << this->logInfo();
+
+				inBuffer.commit(bytesRead);
+				this->dispatchIncomingStream<ProtocolHandler>();
+			} else {
+				VLOG_IF(1, e != boost::asio::error::operation_aborted) << "read error "
+						<< e << " after " << bytesRead << " bytes read" <<  this->logInfo();
+				this->abort(e);
+			}
+		}));
+	}
+
+	/// Reads the rest of a message too big for inBuffer directly into inMsg
+	template <class ProtocolHandler>
+	void readLargeMessage(std::size_t buffered)
+	{
+		updateReadTimer();
+
+		auto sthis = shared_from_this();
+		asyncRead(boost::asio::buffer(inMsg.getBodyBuffer() + buffered), [this, sthis](){
+			if(this->dispatchMessage<ProtocolHandler>() && this->isReceiving())
+				this->dispatchIncomingStream<ProtocolMessageHandler>();
+		});
+	}
+
 	/// Helper function for async socket reading
 	template <class Buffer, class Lambda>
 	void asyncRead(Buffer&& buffer, Lambda&& body)
@@ -288,40 +528,45 @@ private:
 	/// Keeps the read timer alive
 	void updateReadTimer()
 	{
-		impl->readTimer.expires_from_now(boost::posix_time::seconds(ReadTimeOut));
-		waitOnReadTimer();
+		impl->readTimeout.touch(ReadTimeOut);
 	}
 
-	void waitOnReadTimer()
+	/// Keeps the write timer alive
+	void updateWriteTimer()
 	{
-		impl->readTimer.async_wait(impl->strand.wrap([this](const boost::system::error_code &e){
-			DLOG_IF(ERROR, e != boost::asio::error::operation_aborted)
-				<< "read operation timedout after " << ReadTimeOut << "s" << this->logInfo();
-			this->abort(e);
-		}));
+		impl->writeTimeout.touch(WriteTimeOut);
 	}
 
-	/// Keeps the write timer alive
-	void updateWriteTimer()
+	/// Binds the read and write timeouts to this connection
+	void watchTimeouts()
 	{
-		impl->writeTimer.expires_from_now(boost::posix_time::seconds(WriteTimeOut));
-		waitOnWriteTimer();
+		std::weak_ptr<Connection> wthis = shared_from_this();
+		// not reached through sthis->impl, a protocol switch may have moved it already
+		auto strand = &impl->strand;
+
+		impl->readTimeout.setHandler([wthis, strand]{
+			if(auto sthis = wthis.lock())
+				strand->post([sthis]{ sthis->timedOut("read", ReadTimeOut); });
+		});
+
+		impl->writeTimeout.setHandler([wthis, strand]{
+			if(auto sthis = wthis.lock())
+				strand->post([sthis]{ sthis->timedOut("write", WriteTimeOut); });
+		});
 	}
 
-	void waitOnWriteTimer()
+	/// Called by the TimeoutService when a read or write operation takes too long
+	void timedOut(const char* operation, int seconds)
 	{
-		impl->writeTimer.async_wait(impl->strand.wrap(
-		[this](const boost::system::error_code &e){
-			DLOG_IF(ERROR, e != boost::asio::error::operation_aborted)
-				<< "write operation timedout after " << WriteTimeOut << "s" << this->logInfo();
-			this->abort(e);
-		}));
+		if(isStopped()) return;
+
+		DLOG(ERROR) << operation << " operation timedout after " << seconds << "s" << logInfo();
+		abort();
 	}
 
 	/// Called whenever an IO error or timeout occurs
 	void abort(const boost::system::error_code& e)
 	{
-		// timer.cancel() ends with operation_aborted, so we can reuse this function for timers
 		if(e != boost::asio::error::operation_aborted)
 			abort();
 	}
@@ -332,48 +577,217 @@ private:
 		stop();
 	}
 
-	template <class Message, class AfterSend>
-	void trySendOrEnqueueThen(Message&& msg, AfterSend&& then)
+	/*! A message waiting in sendQueue
+	 * Messages are handed to send() by value, so they are moved into a node with a stable
+	 * address for the queue to link. Nodes come and go on every send, they are recycled
+	 * through the BufferPool like the message buffers.
+	 */
+	struct OutgoingNode : MpscQueue<OutgoingNode>::Hook{
+		template <class Message>
+		OutgoingNode(Message&& msg_, bool stopAfterSend_) :
+			msg(std::forward<Message>(msg_)),
+			stopAfterSend(stopAfterSend_)
+		{}
+
+		static void* operator new(std::size_t size)
+		{
+			return BufferPool::instance().allocate(size);
+		}
+
+		static void operator delete(void* node, std::size_t size)
+		{
+			BufferPool::instance().deallocate(static_cast<uint8_t*>(node), size);
+		}
+
+		OutgoingMessage msg;
+		bool stopAfterSend;
+	};
+
+	/*! Enqueues the message without locking
+	 * Only the producer that finds sendQueue empty schedules drainSendQueue() on the strand,
+	 * everyone else just links its message.
+	 */
+	template <class Message>
+	void trySendOrEnqueue(Message&& msg, bool stopAfterSend)
+	{
+		auto node = new OutgoingNode(std::forward<Message>(msg), stopAfterSend);
+
+		// count before pushing, so drainSendQueue never sees more nodes than pendingSends
+		bool first = pendingSends.fetch_add(1, std::memory_order_acq_rel) == 0;
+		sendQueue.push(node);
+
+		if(first){
+			auto sthis = shared_from_this();
+			impl->strand.dispatch([this, sthis]{ this->drainSendQueue(); });
+		}
+	}
+
+	/// Moves every message in sendQueue into outMsgQueue, starting a send if needed
+	void drainSendQueue()
+	{
+		std::size_t drained = 0;
+
+		while(auto node = sendQueue.pop()){
+			std::unique_ptr<OutgoingNode> guard(node);
+			++drained;
+			enqueue(std::move(node->msg), node->stopAfterSend);
+		}
+
+		// some producer is still linking its node, it didn't schedule anything so retry later
+		if(pendingSends.fetch_sub(drained, std::memory_order_acq_rel) != drained){
+			auto sthis = shared_from_this();
+			impl->strand.post([this, sthis]{ this->drainSendQueue(); });
+		}
+	}
+
+	void enqueue(OutgoingMessage&& msg, bool stopAfterSend)
+	{
+		if(!isSendind() || stopMark) return;
+
+		if(!stopAfterSend && (outputPressure.queuedBytes() + msg.getSize() > outputLimits.softBytes
+				|| outMsgQueue.size() >= outputLimits.maxMessages) && !admitCongested(msg))
+			return;
+
+		bool shallSend = outMsgQueue.empty();
+
+		outputPressure.add(msg.getSize(), outputLimits);
+		outMsgQueue.emplace_back(std::move(msg));
+
+		if(stopAfterSend)
+			stopMark = outMsgQueue.size();
+
+		if(shallSend)
+			doSend();
+	}
+
+	/*! Applies outputLimits.policy to a message sent while the connection is congested
+	 * Returns false if the message was already taken care of (dropped, collapsed into a queued
+	 * one or refused because the hard limits are still exceeded) or the connection was aborted,
+	 * true if it must be queued.
+	 */
+	bool admitCongested(OutgoingMessage& msg)
 	{
-		impl->strand.dispatch([=]() mutable{
-			if(!this->isSendind()) return;
+		auto policy = outputLimits.policy;
+
+		if(policy & OutputLimits::CollapseSuperseded && msg.getSupersedeKey()){
+			// messages being written can't be touched
+			for(auto i = inFlight; i < outMsgQueue.size(); ++i){
+				auto& queued = outMsgQueue[i];
+				if(queued.getSupersedeKey() == msg.getSupersedeKey()){
+					outputPressure.remove(queued.getSize(), outputLimits);
+					outputPressure.add(msg.getSize(), outputLimits);
+					queued = std::move(msg);
+					return false;
+				}
+			}
+		}
+
+		if(policy & OutputLimits::DropDroppable && msg.isDroppable()){
+			DVLOG(1) << "dropping message of " << msg.getSize() << " bytes" << logInfo();
+			return false;
+		}
+
+		if(!exceedsHardLimits(msg.getSize()))
+			return true;
+
+		if(policy & OutputLimits::DropDroppable)
+			dropQueuedDroppables();
 
-			//DVLOG(1) << "queuing message " << outMsgQueue.front() << logInfo();
+		if(!exceedsHardLimits(msg.getSize()))
+			return true;
 
-			bool shallSend = outMsgQueue.empty();
+		if(policy & OutputLimits::Disconnect){
+			LOG(INFO) << "output queue over its limits with " << outputPressure.queuedBytes()
+					<< " bytes in " << outMsgQueue.size() << " messages" << droppingLogInfo();
+			abort();
+		} else {
+			LOG(WARNING) << "refusing a message of " << msg.getSize() << " bytes, the output "
+					"queue is over its limits" << logInfo();
+		}
+
+		return false;
+	}
 
-			outMsgQueue.emplace_back(std::forward<Message>(msg));
+	bool exceedsHardLimits(std::size_t incomingBytes)
+	{
+		return outputPressure.queuedBytes() + incomingBytes > outputLimits.hardBytes ||
+				outMsgQueue.size() >= outputLimits.maxMessages;
+	}
 
-			if(shallSend)
-				this->doSend(then);
+	/// Discards every queued droppable message that isn't being written yet
+	void dropQueuedDroppables()
+	{
+		auto newEnd = std::remove_if(outMsgQueue.begin() + inFlight, outMsgQueue.end(),
+		[this](OutgoingMessage& queued){
+			if(!queued.isDroppable())
+				return false;
+			outputPressure.remove(queued.getSize(), outputLimits);
+			return true;
 		});
+
+		DVLOG(1) << "dropping " << (outMsgQueue.end() - newEnd) << " queued messages"
+				<< logInfo();
+
+		outMsgQueue.erase(newEnd, outMsgQueue.end());
 	}
 
-	/// Performs the actual send operation, one message at a time
-	template <class AfterSend>
-	void doSend(AfterSend&& then)
+	/// Lets async_write use outBuffers without copying the vector on every write
+	struct OutBufferSequence{
+		typedef boost::asio::const_buffer value_type;
+		typedef std::vector<boost::asio::const_buffer>::const_iterator const_iterator;
+
+		const_iterator begin() const { return buffers->begin(); }
+		const_iterator end() const { return buffers->end(); }
+
+		const std::vector<boost::asio::const_buffer>* buffers;
+	};
+
+	/*! Performs the actual send operation
+	 * If TypeTraits::GatherWrites is set every queued message (up to the one passed to
+	 * sendAndStop(), if any) is encoded and sent with a single gather write, otherwise
+	 * messages are sent one at a time.
+	 */
+	void doSend()
 	{
 		updateWriteTimer();
 
 		auto sthis = shared_from_this();
-		auto& msg = outMsgQueue.front();
+		std::size_t batchSize = GatherWrites? (stopMark? stopMark : outMsgQueue.size()) : 1;
+
+		outBuffers.clear();
+		inFlight = batchSize;
+		inFlightBytes = 0;
 
 		try{
-			msg.encode();
+			for(std::size_t i = 0; i != batchSize; ++i){
+				auto& msg = outMsgQueue[i];
+				// accounted before encoding, as it was when queued
+				inFlightBytes += msg.getSize();
+				msg.encode();
+				outBuffers.push_back(msg.getBuffer());
+			}
 		} catch(std::exception&){
 			LOG(INFO) << "outgoing message couldn't be encoded" << droppingLogInfo();
 			return this->abort();
 		}
 
-		boost::asio::async_write(impl->peer, msg.getBuffer(),
+		boost::asio::async_write(impl->peer, OutBufferSequence{&outBuffers},
 		impl->strand.wrap(
-		[this, sthis, then](const boost::system::error_code& e, std::size_t bytesWritten) mutable{
+		[this, sthis, batchSize](const boost::system::error_code& e, std::size_t bytesWritten){
 			if(!e){
-				DVLOG(1) << bytesWritten << " bytes written" << this->logInfo();
+				DVLOG(1) << bytesWritten << " bytes written in " << batchSize << " messages"
+						<< this->logInfo();
+
+				for(std::size_t i = 0; i != batchSize; ++i)
+					outMsgQueue.pop_front();
 
-				outMsgQueue.pop_front();
+				inFlight = 0;
+				outputPressure.remove(inFlightBytes, outputLimits);
 
-				then(); // keepSending() or close(), see send/sendAndClose
+				if(stopMark && (stopMark -= batchSize) == 0)
+					this->stop();
+				else
+					this->keepSending();
 
 			} else {
 				DLOG_IF(ERROR, e != boost::asio::error::operation_aborted) << "write error "
@@ -383,19 +797,33 @@ private:
 		}));
 	}
 
+	/// Sends whatever was queued meanwhile, unless the connection was stopped (e.g. aborted by
+	/// the output policies) while the last write was in progress
 	void keepSending()
 	{
-		if(!outMsgQueue.empty())
-			doSend([this]{ keepSending(); });
+		if(!outMsgQueue.empty() && isSendind())
+			doSend();
 		else
-			impl->writeTimer.cancel();
+			impl->writeTimeout.cancel();
 	}
 
 	IncomingMessage inMsg;
+	RingBuffer<ReadBufferSize> inBuffer;
+	MpscQueue<OutgoingNode> sendQueue;
+	std::atomic<std::size_t> pendingSends {0};
 	std::deque<OutgoingMessage> outMsgQueue;
+	std::vector<boost::asio::const_buffer> outBuffers;
+	/// Number and unencoded size of the messages at the front of outMsgQueue being written
+	std::size_t inFlight {0};
+	std::size_t inFlightBytes {0};
+	OutputLimits outputLimits {TypeTraits::OutputSoftLimit, TypeTraits::OutputHardLimit,
+		TypeTraits::OutputMaxMessages, TypeTraits::OutputPolicy};
+	OutputPressure outputPressure;
+	/// Number of queued messages to send before stopping, 0 if sendAndStop wasn't called
+	std::size_t stopMark {0};
 	ProtocolPtr protocol;
 	std::unique_ptr<ConnectionImpl> impl;
-	char closeStatus {0};
+	std::atomic<char> closeStatus {0};
 };
 
 } /* namespace otservpp */
@@ -0,0 +1,36 @@
+#include "gameinbox.h"
+#include <memory>
+
+namespace otservpp {
+
+GameInbox& GameInbox::instance()
+{
+	static GameInbox inbox;
+	return inbox;
+}
+
+GameInbox::~GameInbox()
+{
+	while(auto node = queue.pop())
+		delete node;
+}
+
+void GameInbox::post(std::function<void()> task)
+{
+	queue.push(new Node(std::move(task)));
+}
+
+std::size_t GameInbox::drain()
+{
+	std::size_t count = 0;
+
+	while(auto node = queue.pop()){
+		std::unique_ptr<Node> guard(node);
+		++count;
+		node->task();
+	}
+
+	return count;
+}
+
+} /* namespace otservpp */
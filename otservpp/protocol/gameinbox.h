@@ -0,0 +1,51 @@
+#ifndef OTSERVPP_GAMEINBOX_H_
+#define OTSERVPP_GAMEINBOX_H_
+
+#include <functional>
+#include "../mpscqueue.hpp"
+
+namespace otservpp {
+
+/*! Incoming work handed from the I/O threads to the game thread
+ * Protocols decode (checksum, decryption) their messages in the connection's strand and post
+ * the plaintext handling here, so the game thread only runs game logic. The game loop calls
+ * drain() periodically (e.g. once per tick).
+ *
+ * \note post() is thread-safe and lock-free, drain() must always be called from the same
+ * thread
+ */
+class GameInbox{
+public:
+	/// Returns the process wide inbox
+	static GameInbox& instance();
+
+	GameInbox() = default;
+
+	~GameInbox();
+
+	/// Queues task to be run by the next drain()
+	void post(std::function<void()> task);
+
+	/*! Runs every task queued so far, returns how many were run
+	 * A task whose post() is still in progress may be left for the next call.
+	 */
+	std::size_t drain();
+
+	GameInbox(GameInbox&) = delete;
+	void operator=(GameInbox&) = delete;
+
+private:
+	struct Node : MpscQueue<Node>::Hook{
+		explicit Node(std::function<void()>&& task_) :
+			task(std::move(task_))
+		{}
+
+		std::function<void()> task;
+	};
+
+	MpscQueue<Node> queue;
+};
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_GAMEINBOX_H_
@@ -0,0 +1,43 @@
+#include "outputlimits.h"
+
+namespace otservpp {
+
+std::atomic<std::size_t> OutputPressure::congestedCount {0};
+
+OutputPressure::~OutputPressure()
+{
+	if(congested)
+		congestedCount.fetch_sub(1, std::memory_order_relaxed);
+}
+
+std::size_t OutputPressure::congestedConnections()
+{
+	return congestedCount.load(std::memory_order_relaxed);
+}
+
+void OutputPressure::add(std::size_t bytes_, const OutputLimits& limits)
+{
+	bytes += bytes_;
+	update(limits);
+}
+
+void OutputPressure::remove(std::size_t bytes_, const OutputLimits& limits)
+{
+	bytes -= bytes_;
+	update(limits);
+}
+
+void OutputPressure::update(const OutputLimits& limits)
+{
+	bool nowCongested = bytes > limits.softBytes;
+
+	if(nowCongested != congested){
+		congested = nowCongested;
+		if(congested)
+			congestedCount.fetch_add(1, std::memory_order_relaxed);
+		else
+			congestedCount.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+} /* namespace otservpp */
@@ -0,0 +1,72 @@
+#ifndef OTSERVPP_OUTPUTLIMITS_H_
+#define OTSERVPP_OUTPUTLIMITS_H_
+
+#include <atomic>
+#include <cstddef>
+
+namespace otservpp {
+
+/*! Bounds on the amount of data a connection may keep queued for writing
+ * Once the queued bytes go over softBytes the connection is considered congested and the
+ * policy flags start to apply to new messages. Going over hardBytes or maxMessages (with
+ * whatever non-droppable message is left) is handled by disconnecting the peer when
+ * Disconnect is set, otherwise the new message is refused, so the limits always hold.
+ */
+struct OutputLimits{
+	enum Policy{
+		/// Droppable messages are discarded while congested, queued ones first
+		DropDroppable = 0x01,
+		/// A message with a supersede key replaces a queued one with the same key while congested
+		CollapseSuperseded = 0x02,
+		/// The connection is aborted when the hard limits can't be honored otherwise
+		Disconnect = 0x04
+	};
+
+	std::size_t softBytes;
+	std::size_t hardBytes;
+	std::size_t maxMessages;
+	int policy;
+};
+
+/*! Bookkeeping of the bytes and messages queued by a connection
+ * Also maintains a process wide count of the connections currently above their soft limit,
+ * which can be used as a hint of how many peers are falling behind.
+ */
+class OutputPressure{
+public:
+	OutputPressure() = default;
+
+	~OutputPressure();
+
+	/// Number of connections whose queued bytes are above their soft limit right now
+	static std::size_t congestedConnections();
+
+	void add(std::size_t bytes, const OutputLimits& limits);
+
+	void remove(std::size_t bytes, const OutputLimits& limits);
+
+	std::size_t queuedBytes() const
+	{
+		return bytes;
+	}
+
+	bool isCongested() const
+	{
+		return congested;
+	}
+
+	OutputPressure(OutputPressure&) = delete;
+	void operator=(OutputPressure&) = delete;
+
+private:
+	void update(const OutputLimits& limits);
+
+	static std::atomic<std::size_t> congestedCount;
+
+	std::size_t bytes {0};
+	bool congested {false};
+};
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_OUTPUTLIMITS_H_
@@ -1,7 +1,10 @@
 #ifndef OTSERVPP_STANDARDPROTOCOL_HPP_
 #define OTSERVPP_STANDARDPROTOCOL_HPP_
 
+#include <mutex>
 #include "basicprotocol.hpp"
+#include "tickflushlist.h"
+#include "gameinbox.h"
 #include "../message/standardinmessage.h"
 #include "../message/standardoutmessage.h"
 
@@ -18,9 +21,21 @@ public:
 	typedef typename BaseProtocol::ConnectionPtrType ConnectionPtrType;
 
 	StandardProtocol(const ConnectionPtrType& conn) :
-		BaseProtocol(conn)
+		BaseProtocol(conn),
+		pending(std::make_shared<PendingPacket>(conn))
 	{}
 
+	/// Also stops the send functions from reaching the connection, whatever thread they run in
+	void connectionLost()
+	{
+		{
+			std::lock_guard<std::recursive_mutex> lock(pending->mutex);
+			pending->connection.reset();
+		}
+
+		BaseProtocol::connectionLost();
+	}
+
 	void handleFirstMessage(StandardInMessage& msg)
 	{
 		try{
@@ -31,17 +46,42 @@ public:
 		}
 	}
 
+	/*! Decodes msg in the connection's strand and handles it there, or in the game thread if
+	 * a GameInbox was set
+	 */
 	void handleMessage(StandardInMessage& msg)
 	{
 		try{
 			msg.doChecksum();
 			msg.xteaDecrypt(xtea);
-			static_cast<Protocol*>(this)->onMessage(msg);
+
+			if(gameInbox)
+				postToGameInbox(msg);
+			else
+				static_cast<Protocol*>(this)->onMessage(msg);
 		} catch(PacketException& e){
 			handlePacketException();
 		}
 	}
 
+	/*! Handles a decoded message from the game thread, see setGameInbox()
+	 * The connection member belongs to the strand, so conn (the one the message came from) is
+	 * stopped on invalid packets (or any other exception thrown by the protocol) instead.
+	 */
+	void handleGameMessage(StandardInMessage& msg, Connection<Protocol>& conn)
+	{
+		try{
+			static_cast<Protocol*>(this)->onMessage(msg);
+		} catch(PacketException& e){
+			LOG(INFO) << "invalid packet received in the game thread, dropping connection";
+			conn.stop();
+		} catch(std::exception& e){
+			LOG(ERROR) << "unexpected exception caught in the game thread, dropping connection. "
+					"What: " << e.what();
+			conn.stop();
+		}
+	}
+
 protected:
 	using BaseProtocol::handlePacketException;
 	using BaseProtocol::wrapHandler;
@@ -55,9 +95,13 @@ protected:
 		assert(false);
 	}
 
+	/// Also applies to whatever was written during this tick but isn't flushed yet
 	void setXtea(const crypto::Xtea& xtea_)
 	{
 		xtea = xtea_;
+
+		std::lock_guard<std::recursive_mutex> lock(pending->mutex);
+		pending->xtea = xtea_;
 	}
 
 	crypto::Xtea& getXtea()
@@ -65,28 +109,168 @@ protected:
 		return xtea;
 	}
 
-	void sendUnencrypted(StandardOutMessage& msg)
+	/*! Makes every message after the first one be handled (Protocol::onMessage) by whoever
+	 * drains inbox instead of the connection's strand, messages are already decoded by then
+	 * \note onMessage then runs concurrently with the strand, so it must not use the connection
+	 * member, only the send functions, which are safe from any thread
+	 */
+	void setGameInbox(GameInbox& inbox)
 	{
-		msg.addHeader();
-		connection->send(msg);
+		gameInbox = &inbox;
 	}
 
-	void send(StandardOutMessage& msg)
+	/*! The send functions take msg over (callers std::move() it in), its buffer goes back to
+	 * the BufferPool once it's written. They do nothing once the connection is lost.
+	 * \note The send functions are thread-safe
+	 */
+	void sendUnencrypted(StandardOutMessage&& msg)
 	{
+		std::lock_guard<std::recursive_mutex> lock(pending->mutex);
+		auto conn = pending->connection;
+		if(!conn) return;
+
+		flushPending(*pending, *conn);
 		msg.addHeader();
-		msg.xteaEncrypt(xtea);
-		connection->send(msg);
+		conn->send(std::move(msg));
 	}
 
-	void sendAndStop(StandardOutMessage& msg)
+	/*! Appends msg to the packet aggregated for this connection during the current tick
+	 * Every message written in a tick ends in the same packet, which gets its header and is
+	 * encrypted once when TickFlushList::flushAll() is called at the end of the tick, or earlier
+	 * if it would grow past STANDARD_OUT_MESSAGE_MAX_SIZE. Without a game loop driving the
+	 * TickFlushList the packet is flushed from the connection's strand instead, after the
+	 * handler running there (if any) returns. A message that can't fit in a packet even on its
+	 * own is dropped, and false is returned.
+	 * \note This function is thread-safe
+	 */
+	bool write(const StandardOutMessage& msg)
 	{
-		msg.addHeader();
-		msg.xteaEncrypt(xtea);
-		connection->sendAndStop(msg);
+		if(msg.getSize() + PacketSlack > STANDARD_OUT_MESSAGE_MAX_SIZE){
+			LOG(ERROR) << "dropping a " << msg.getSize() << " bytes message bigger than a packet";
+			return false;
+		}
+
+		std::lock_guard<std::recursive_mutex> lock(pending->mutex);
+		auto conn = pending->connection;
+		if(!conn) return true;
+
+		if(pending->msg.getSize() + msg.getSize() + PacketSlack > STANDARD_OUT_MESSAGE_MAX_SIZE)
+			flushPending(*pending, *conn);
+
+		pending->msg.addMessage(msg);
+
+		if(!pending->scheduled){
+			pending->scheduled = true;
+			scheduleFlush(*conn);
+		}
+
+		return true;
+	}
+
+	/// Sends whatever was written during this tick right away
+	void flush()
+	{
+		std::lock_guard<std::recursive_mutex> lock(pending->mutex);
+		if(auto conn = pending->connection)
+			flushPending(*pending, *conn);
+	}
+
+	/// Sends msg in its own packet, after anything written during this tick
+	void send(StandardOutMessage&& msg)
+	{
+		std::lock_guard<std::recursive_mutex> lock(pending->mutex);
+		auto conn = pending->connection;
+		if(!conn) return;
+
+		flushPending(*pending, *conn);
+		msg.deferXteaEncrypt(pending->xtea);
+		conn->send(std::move(msg));
+	}
+
+	void sendAndStop(StandardOutMessage&& msg)
+	{
+		std::lock_guard<std::recursive_mutex> lock(pending->mutex);
+		auto conn = pending->connection;
+		if(!conn) return;
+
+		flushPending(*pending, *conn);
+		msg.deferXteaEncrypt(pending->xtea);
+		conn->sendAndStop(std::move(msg));
 	}
 
 private:
+	enum{
+		/// Room needed in a packet besides its body: prefixes and XTEA padding
+		PacketSlack = STANDARD_OUT_MESSAGE_PREFIX_SIZE + 8
+	};
+
+	/*! Packet being aggregated, shared with the TickFlushList so it can outlive the protocol
+	 * It keeps its own copy of the key, so flushes use the one set last even when they happen
+	 * from the flush list, and its own connection pointer, which connectionLost() clears under
+	 * the mutex so the game thread never races with the strand on it. The mutex is recursive
+	 * because sending from the strand can abort the connection, and so call connectionLost(),
+	 * before returning.
+	 */
+	struct PendingPacket{
+		explicit PendingPacket(const ConnectionPtrType& conn) :
+			connection(conn)
+		{}
+
+		std::recursive_mutex mutex;
+		ConnectionPtrType connection;
+		StandardOutMessage msg;
+		crypto::Xtea xtea;
+		bool scheduled {false};
+	};
+
+	/// Sends the aggregated packet, if any, must be called with pending.mutex locked
+	static void flushPending(PendingPacket& pending, Connection<Protocol>& conn)
+	{
+		if(pending.msg.getSize() == 0) return;
+
+		pending.msg.deferXteaEncrypt(pending.xtea);
+		conn.send(std::move(pending.msg));
+		pending.msg = StandardOutMessage();
+	}
+
+	/*! The message is moved, Connection resets inMsg before receiving the next one anyway
+	 * The copy handed to the game thread is allocated from the BufferPool, and only holds the
+	 * received bytes (or the buffer borrowed for them).
+	 */
+	void postToGameInbox(StandardInMessage& msg)
+	{
+		auto self = connection->getProtocol();
+		auto conn = connection;
+		auto plain = std::allocate_shared<StandardInMessage>(PoolAllocator<StandardInMessage>(),
+				std::move(msg));
+
+		gameInbox->post([self, conn, plain]{
+			if(!conn->isStopped())
+				self->handleGameMessage(*plain, *conn);
+		});
+	}
+
+	void scheduleFlush(Connection<Protocol>& conn)
+	{
+		std::weak_ptr<PendingPacket> weakPending(pending);
+
+		auto flush = [weakPending]{
+			auto pending = weakPending.lock();
+			if(!pending) return;
+
+			std::lock_guard<std::recursive_mutex> lock(pending->mutex);
+			pending->scheduled = false;
+			if(auto conn = pending->connection)
+				flushPending(*pending, *conn);
+		};
+
+		if(!TickFlushList::instance().addIfDriven(flush))
+			conn.post(flush);
+	}
+
 	crypto::Xtea xtea;
+	std::shared_ptr<PendingPacket> pending;
+	GameInbox* gameInbox {nullptr};
 };
 
 } /* namespace otservpp */
@@ -0,0 +1,53 @@
+#include "tickflushlist.h"
+
+namespace otservpp {
+
+TickFlushList& TickFlushList::instance()
+{
+	static TickFlushList list;
+	return list;
+}
+
+void TickFlushList::add(std::function<void()> flush)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	pending.push_back(std::move(flush));
+}
+
+bool TickFlushList::addIfDriven(std::function<void()> flush)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if(!driven)
+		return false;
+
+	pending.push_back(std::move(flush));
+	return true;
+}
+
+void TickFlushList::setDriven(bool driven_)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	driven = driven_;
+}
+
+void TickFlushList::flushAll()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.swap(flushing);
+	}
+
+	// both vectors keep their capacity, so steady ticks don't allocate
+	for(auto& flush : flushing)
+		flush();
+
+	flushing.clear();
+}
+
+std::size_t TickFlushList::size()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return pending.size();
+}
+
+} /* namespace otservpp */
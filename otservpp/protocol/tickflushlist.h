@@ -0,0 +1,58 @@
+#ifndef OTSERVPP_TICKFLUSHLIST_H_
+#define OTSERVPP_TICKFLUSHLIST_H_
+
+#include <mutex>
+#include <vector>
+#include <functional>
+
+namespace otservpp {
+
+/*! Output flushes deferred until the end of the current game tick
+ * Protocols aggregating their output register a flush function the first time they write
+ * something during a tick, the game loop calls flushAll() once the tick is processed so every
+ * connection gets a single packet per tick. A game loop marks the list as driven while it
+ * runs (see Dispatcher), protocols flush by other means otherwise.
+ *
+ * \note All the functions in this class are thread-safe, but flushAll() must always be
+ * called from the same (game loop) thread
+ */
+class TickFlushList{
+public:
+	/// Returns the process wide list
+	static TickFlushList& instance();
+
+	/// Schedules flush to be called (once) by the next flushAll()
+	void add(std::function<void()> flush);
+
+	/// Same as add() if the list is driven, otherwise flush is dropped and false is returned
+	bool addIfDriven(std::function<void()> flush);
+
+	/*! Tells whether a game loop is calling flushAll()
+	 * Once this is set to false addIfDriven() stops adding, so one last flushAll() takes care
+	 * of every pending flush.
+	 */
+	void setDriven(bool driven);
+
+	/*! Calls and forgets every function added since the last call
+	 * Functions added while flushing are kept for the next call.
+	 */
+	void flushAll();
+
+	/// Number of flushes waiting for the next flushAll()
+	std::size_t size();
+
+	TickFlushList() = default;
+
+	TickFlushList(TickFlushList&) = delete;
+	void operator=(TickFlushList&) = delete;
+
+private:
+	std::mutex mutex;
+	std::vector<std::function<void()>> pending;
+	std::vector<std::function<void()>> flushing;
+	bool driven {false};
+};
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_TICKFLUSHLIST_H_
@@ -0,0 +1,168 @@
+#include "timeoutservice.h"
+
+namespace otservpp {
+
+boost::asio::io_service::id TimeoutService::id;
+
+TimeoutService::Entry::Entry(boost::asio::io_service& ioService) :
+	service(boost::asio::use_service<TimeoutService>(ioService))
+{}
+
+TimeoutService::Entry::~Entry()
+{
+	cancel();
+}
+
+void TimeoutService::Entry::setHandler(std::function<void()> handler)
+{
+	std::lock_guard<std::mutex> lock(service.mutex);
+	onTimeout = std::move(handler);
+}
+
+void TimeoutService::Entry::touch(int seconds)
+{
+	std::lock_guard<std::mutex> lock(service.mutex);
+	service.disarm(*this);
+	service.link(*this, seconds);
+}
+
+void TimeoutService::Entry::cancel()
+{
+	std::lock_guard<std::mutex> lock(service.mutex);
+	service.disarm(*this);
+}
+
+TimeoutService::TimeoutService(boost::asio::io_service& ioService) :
+	boost::asio::io_service::service(ioService),
+	timer(ioService)
+{
+	wheel.fill(nullptr);
+}
+
+void TimeoutService::shutdown_service()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	ticking = false;
+	timer.cancel();
+}
+
+void TimeoutService::link(Entry& e, int seconds)
+{
+	// +1 since we may be in the middle of the current tick
+	e.expiry = currentTick + seconds/Resolution + 1;
+
+	auto& head = wheel[e.expiry & (Slots-1)];
+	e.prev = nullptr;
+	e.next = head;
+	if(head)
+		head->prev = &e;
+	head = &e;
+
+	e.linked = true;
+	++linkedEntries;
+
+	if(!ticking){
+		ticking = true;
+		timer.expires_from_now(boost::posix_time::seconds((int)Resolution));
+		scheduleSweep();
+	}
+}
+
+void TimeoutService::unlink(Entry& e)
+{
+	if(!e.linked)
+		return;
+
+	if(e.prev)
+		e.prev->next = e.next;
+	else
+		wheel[e.expiry & (Slots-1)] = e.next;
+
+	if(e.next)
+		e.next->prev = e.prev;
+
+	e.linked = false;
+	--linkedEntries;
+}
+
+void TimeoutService::disarm(Entry& e)
+{
+	unlink(e);
+
+	if(e.expiring){
+		expired[e.expiring-1] = nullptr;
+		e.expiring = 0;
+	}
+}
+
+void TimeoutService::scheduleSweep()
+{
+	timer.async_wait([this](const SystemErrorCode& e){
+		if(e != boost::asio::error::operation_aborted)
+			sweep();
+	});
+}
+
+void TimeoutService::sweep()
+{
+	std::size_t expiredCount;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if(!ticking)
+			return;
+
+		++currentTick;
+
+		auto entry = wheel[currentTick & (Slots-1)];
+		while(entry){
+			auto next = entry->next;
+
+			// entries further than Slots seconds away wait for another lap
+			if(entry->expiry <= currentTick){
+				unlink(*entry);
+				expired.push_back(entry);
+				entry->expiring = expired.size();
+			}
+
+			entry = next;
+		}
+
+		expiredCount = expired.size();
+	}
+
+	// the owner of an entry may be destroyed, and cancel() it, from its handler, so each entry
+	// is checked again right before calling it. The handler is copied for the same reason
+	for(std::size_t i = 0; i != expiredCount; ++i){
+		std::function<void()> handler;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto entry = expired[i];
+			if(!entry) continue;
+
+			entry->expiring = 0;
+			handler = entry->onTimeout;
+		}
+
+		if(handler)
+			handler();
+	}
+
+	// rescheduled only now, so sweeps never overlap while using expired. Entries linked
+	// meanwhile found ticking set and rely on this
+	std::lock_guard<std::mutex> lock(mutex);
+	expired.clear();
+
+	if(!ticking)
+		return;
+
+	if(linkedEntries == 0){
+		ticking = false;
+	} else {
+		// keep a fixed rate, sweeps don't drift
+		timer.expires_at(timer.expires_at() + boost::posix_time::seconds((int)Resolution));
+		scheduleSweep();
+	}
+}
+
+} /* namespace otservpp */
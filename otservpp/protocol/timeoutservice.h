@@ -0,0 +1,97 @@
+#ifndef OTSERVPP_TIMEOUTSERVICE_H_
+#define OTSERVPP_TIMEOUTSERVICE_H_
+
+#include <array>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include "../networkdcl.hpp"
+
+namespace otservpp {
+
+/*! Coarse grained timeouts shared by every connection of an io_service
+ * Instead of owning one deadline_timer per timeout, connections register Entry objects in a
+ * hashed timing wheel with a resolution of one second. Touching an entry (i.e. restarting
+ * its timeout) only relinks it in a list, and a single timer sweeps one wheel slot every
+ * second calling the handler of each expired entry.
+ *
+ * The ticking timer only runs while there are entries waiting to expire, so the service
+ * doesn't keep io_service::run() from returning.
+ *
+ * \note All the functions in this class are thread-safe
+ */
+class TimeoutService : public boost::asio::io_service::service{
+public:
+	/// Seconds between sweeps
+	enum{ Resolution = 1 };
+
+	/*! A timeout registered in the wheel
+	 * Entries are re-armed with touch() and disarmed with cancel(), both O(1). The handler is
+	 * called from the sweeping thread, so it should be short (e.g. posting into a strand). It
+	 * runs after its entry was unlinked and without the service lock held, so it may touch or
+	 * cancel entries and even destroy its own. An entry touched, canceled or destroyed after
+	 * expiring, but before the sweep got to call its handler, isn't called.
+	 */
+	class Entry{
+	public:
+		explicit Entry(boost::asio::io_service& ioService);
+
+		~Entry();
+
+		/// Sets the function called when the entry expires
+		void setHandler(std::function<void()> handler);
+
+		/// (Re)starts the timeout, the handler will be called after [seconds, seconds+1)
+		void touch(int seconds);
+
+		/// Stops the timeout, the handler won't be called
+		void cancel();
+
+		Entry(Entry&) = delete;
+		void operator=(Entry&) = delete;
+
+	private:
+		friend class TimeoutService;
+
+		TimeoutService& service;
+		std::function<void()> onTimeout;
+		Entry* prev {nullptr};
+		Entry* next {nullptr};
+		uint64_t expiry {0};
+		/// Position (plus one) in TimeoutService::expired while waiting for its handler call
+		std::size_t expiring {0};
+		bool linked {false};
+	};
+
+	static boost::asio::io_service::id id;
+
+	explicit TimeoutService(boost::asio::io_service& ioService);
+
+	void shutdown_service() override;
+
+private:
+	// power of 2 greater than the usual timeouts, so most entries are swept only once
+	enum{ Slots = 64 };
+
+	void link(Entry& e, int seconds);
+	void unlink(Entry& e);
+
+	/// Unlinks the entry and takes it out of the current sweep, if it's waiting there
+	void disarm(Entry& e);
+
+	void scheduleSweep();
+	void sweep();
+
+	std::mutex mutex;
+	std::array<Entry*, Slots> wheel;
+	/// Entries expired by the running sweep, kept between sweeps to reuse its storage
+	std::vector<Entry*> expired;
+	uint64_t currentTick {0};
+	std::size_t linkedEntries {0};
+	bool ticking {false};
+	boost::asio::deadline_timer timer;
+};
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_TIMEOUTSERVICE_H_
@@ -2,6 +2,7 @@
 #define OTSERVPP_PROTOCOLTRAITS_HPP_
 
 #include "../forwarddcl.hpp"
+#include "outputlimits.h"
 
 namespace otservpp {
 
@@ -26,7 +27,35 @@ struct ProtocolTraits{
 		/*! Should be set to the time in seconds this connection will wait on write operations
 		 * before timing out
 		 */
-		WriteTimeOut = 30  ///<
+		WriteTimeOut = 30,
+
+		/*! When non-zero the connection flushes every queued message with a single gather
+		 * write, otherwise messages are written one at a time
+		 */
+		GatherWrites = 1,
+
+		/*! Size in bytes (a power of 2) of the buffer used to read incoming data in bulk. Every
+		 * complete message found after a read is dispatched, messages that don't fit in the
+		 * buffer are read directly into the IncomingMessage. The buffer is borrowed from the
+		 * BufferPool only while there's data to read, idle connections don't hold one. When 0
+		 * every message is read with two separated reads (header and body)
+		 */
+		ReadBufferSize = 4096,
+
+		/*! Queued outgoing bytes above which the connection is considered congested and the
+		 * OutputPolicy starts to apply. Can be changed per connection, see OutputLimits
+		 */
+		OutputSoftLimit = 64*1024,
+
+		/// Queued outgoing bytes the connection shouldn't go over
+		OutputHardLimit = 1024*1024,
+
+		/// Queued outgoing messages the connection shouldn't go over
+		OutputMaxMessages = 4096,
+
+		/// Combination of OutputLimits::Policy flags
+		OutputPolicy = OutputLimits::DropDroppable | OutputLimits::CollapseSuperseded |
+				OutputLimits::Disconnect
 	};
 };
 
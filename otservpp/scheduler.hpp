@@ -2,10 +2,16 @@
 #define OTSERVPP_SCHEDULER_HPP_
 
 #include <functional>
-#include <boost/thread/thread.hpp>
+#include <list>
+#include <mutex>
 #include "forwarddcl.hpp"
 #include "networkdcl.hpp"
 #include "lambdautil.hpp"
+#include "timerengine.hpp"
+#include "parallelfor.hpp"
+#include "schedulerstats.h"
+#include "workstealingpool.h"
+#include "message/bufferpool.h"
 
 namespace otservpp {
 
@@ -22,16 +28,53 @@ public:
 		return timer.cancel() > 0;
 	}
 
+	/// Name under which the runtime of this task is recorded, see SchedulerStats
+	const char* getTag() const
+	{
+		return tag;
+	}
+
 	BaseDeferredTask(BaseDeferredTask&) = delete;
 	void operator=(BaseDeferredTask&) = delete;
 
 protected:
-	explicit BaseDeferredTask(boost::asio::io_service& ioService) :
-		timer(ioService)
+	BaseDeferredTask(boost::asio::io_service& ioService, const char* tag_) :
+		timer(ioService),
+		tag(tag_)
+	{}
+
+	BaseDeferredTask(TimerEngine& engine, const char* tag_) :
+		timer(engine),
+		tag(tag_)
 	{}
 
 	~BaseDeferredTask() = default;
 
+	/// Records the lateness and the runtime of the task if it's run successfully
+	class Probe{
+	public:
+		Probe(BaseDeferredTask& task, const SystemErrorCode& e) :
+			tag(nullptr)
+		{
+			if(e || !SchedulerStats::isEnabled())
+				return;
+
+			SchedulerStats::recordLateness(task.timer.lateness());
+			tag = task.tag? task.tag : SchedulerStats::Untagged;
+			start = SchedulerStats::Clock::now();
+		}
+
+		~Probe()
+		{
+			if(tag)
+				SchedulerStats::recordRuntime(tag, SchedulerStats::microsecondsSince(start));
+		}
+
+	private:
+		const char* tag;
+		SchedulerStats::Clock::time_point start;
+	};
+
 	// these overloads provide dispatching for tasks with different arities, while keeping
 	// a shared_ptr alive in the async_wait
 	template <class Func, class TaskWrapperPtr>
@@ -39,7 +82,10 @@ protected:
 	schedule(int ms, const TaskWrapperPtr& sthis, Func&& fn)
 	{
 		expiresFromNow(ms);
-		timer.async_wait([sthis, fn](const SystemErrorCode& e) mutable { fn(e); });
+		timer.asyncWait([sthis, fn](const SystemErrorCode& e) mutable {
+			Probe probe(*sthis, e);
+			fn(e);
+		});
 	}
 
 	template <class Func, class TaskWrapperPtr>
@@ -48,15 +94,19 @@ protected:
 	{
 		expiresFromNow(ms);
 		auto dthis = sthis.get();
-		timer.async_wait([dthis, sthis, fn](const SystemErrorCode& e) mutable { fn(e, dthis); });
+		timer.asyncWait([dthis, sthis, fn](const SystemErrorCode& e) mutable {
+			Probe probe(*dthis, e);
+			fn(e, dthis);
+		});
 	}
 
 	void expiresFromNow(int ms)
 	{
-		timer.expires_from_now(boost::posix_time::millisec(ms));
+		timer.expiresFromNow(ms);
 	}
 
-	boost::asio::deadline_timer timer;
+	TaskTimer timer;
+	const char* tag;
 };
 
 /*! Scheduling of tasks in a one-liner
@@ -66,6 +116,12 @@ protected:
  *
  * The signature of every task must be either void task(const SystemErrorCode& e) or
  * void task(const SystemErrorCode& e, DeferredTask* _this).
+ *
+ * Tasks constructed with a TimerEngine (e.g. a TimerWheel) are timed by it instead of owning
+ * an asio deadline_timer, the behavior is the same.
+ *
+ * The optional tag is a static name under which the task's runtime is recorded, see
+ * SchedulerStats.
  */
 class DeferredTask :
 	public BaseDeferredTask, public std::enable_shared_from_this<DeferredTask>{
@@ -73,11 +129,12 @@ public:
 	typedef void(*Unary)(const SystemErrorCode&);
 	typedef void(*Binary)(const SystemErrorCode&, DeferredTask*);
 
-	template <class... Args>
-	friend DeferredTaskPtr makeDeferredTask(boost::asio::io_service& ioService, Args&&... args);
+	explicit DeferredTask(boost::asio::io_service& ioService, const char* tag = nullptr) :
+		BaseDeferredTask(ioService, tag)
+	{}
 
-	explicit DeferredTask(boost::asio::io_service& ioService) :
-		BaseDeferredTask(ioService)
+	explicit DeferredTask(TimerEngine& engine, const char* tag = nullptr) :
+		BaseDeferredTask(engine, tag)
 	{}
 
 	/// Schedules the execution of the bounded task, if there was another task pending for
@@ -89,11 +146,15 @@ public:
 	}
 };
 
-template <class... Args>
-inline DeferredTaskPtr makeDeferredTask(boost::asio::io_service& ioService, Args&&... args)
+/// Makes and starts a DeferredTask timed by timerSource, either an io_service or a TimerEngine
+template <class TimerSource, class Func>
+inline DeferredTaskPtr makeDeferredTask(TimerSource& timerSource, int millisec, Func&& func,
+		const char* tag = nullptr)
 {
-	auto task = std::make_shared<DeferredTask>(ioService);
-	task->start(std::forward<Args>(args)...);
+	// the control block comes from the BufferPool, so churning tasks don't hit malloc
+	auto task = std::allocate_shared<DeferredTask>(PoolAllocator<DeferredTask>(),
+			timerSource, tag);
+	task->start(millisec, std::forward<Func>(func));
 	return task;
 }
 
@@ -103,20 +164,25 @@ inline DeferredTaskPtr makeDeferredTask(boost::asio::io_service& ioService, Args
  * interrupted by a thrown exception or by an asio::io_service error. After the continuous
  * execution is stopped, the IntervalTask will deleted provided there's no object holding
  * a reference to it.
+ *
+ * The timerSource of the constructors is either an io_service or a TimerEngine, and tag the
+ * name of the task's runtime, see DeferredTask.
  */
 class IntervalTask :
 	public BaseDeferredTask, public std::enable_shared_from_this<IntervalTask>{
 public:
 	typedef void(*Unary)(const SystemErrorCode&);
 	typedef void(*Binary)(const SystemErrorCode&, IntervalTask*);
-	typedef std::function<std::remove_pointer<Binary>::type> TaskStorage;
+	typedef InlineFunction<std::remove_pointer<Binary>::type> TaskStorage;
 
 
 	/// Constructs an IntervalTask with the given millisec interval and task in the form:
 	/// void task(const SystemErrorCode& e, IntervalTask*)
-	template <class Func, class std::enable_if<function_traits<Func>::arity == 2, int>::type = 0>
-	IntervalTask(boost::asio::io_service& ioService, int millisec, Func&& func) :
-		BaseDeferredTask(ioService),
+	template <class TimerSource, class Func,
+			typename std::enable_if<function_traits<Func>::arity == 2, int>::type = 0>
+	IntervalTask(TimerSource& timerSource, int millisec, Func&& func,
+			const char* tag = nullptr) :
+		BaseDeferredTask(timerSource, tag),
 		ms(millisec),
 		// interval logic
 		fn([func](const SystemErrorCode& e, IntervalTask* this_) mutable {
@@ -128,10 +194,12 @@ public:
 
 	/// Constructs an IntervalTask with the given millisec interval and task in the form:
 	/// void task(const SystemErrorCode& e)
-	template <class Func, class std::enable_if<function_traits<Func>::arity == 1, int>::type = 0>
-	IntervalTask(boost::asio::io_service& ioService, int millisec, Func&& func) :
-		IntervalTask(ioService, millisec,
-			[func](const SystemErrorCode& e, IntervalTask*) mutable { func(e); })
+	template <class TimerSource, class Func,
+			typename std::enable_if<function_traits<Func>::arity == 1, int>::type = 0>
+	IntervalTask(TimerSource& timerSource, int millisec, Func&& func,
+			const char* tag = nullptr) :
+		IntervalTask(timerSource, millisec,
+			[func](const SystemErrorCode& e, IntervalTask*) mutable { func(e); }, tag)
 	{}
 
 	/// Starts the execution of the bounded task
@@ -149,7 +217,9 @@ public:
 	 */
 	void reschedule()
 	{
-		schedule(ms, shared_from_this(), fn);
+		// the task stays in fn, the timer only needs to get back to it
+		schedule(ms, shared_from_this(),
+			[](const SystemErrorCode& e, IntervalTask* this_){ this_->fn(e, this_); });
 	}
 
 	/// Does the same as the nularity version but it also changes the current interval
@@ -167,7 +237,8 @@ private:
 template <class... Args>
 inline IntervalTaskPtr makeIntervalTask(Args&&... args)
 {
-	auto task = std::make_shared<IntervalTask>(std::forward<Args>(args)...);
+	auto task = std::allocate_shared<IntervalTask>(PoolAllocator<IntervalTask>(),
+			std::forward<Args>(args)...);
 	task->start();
 	return task;
 }
@@ -178,10 +249,18 @@ inline IntervalTaskPtr makeIntervalTask(Args&&... args)
  * This class implements useful functions for dealing with scheduling. The signature of every
  * task must be:
  * 		void task();
+ *
+ * Deferred and interval tasks take an optional static tag, the name under which their
+ * runtime is recorded (see SchedulerStats).
+ *
+ * Deferred and interval tasks own an asio deadline_timer unless the Scheduler is given a
+ * TimerEngine, servers with lots of live timers should use the io_service's TimerWheel:
+ * 		Scheduler scheduler(ioService, boost::asio::use_service<TimerWheel>(ioService));
+ * Simulations and tests can use a VirtualClock instead, to run faster than real time.
  */
 class Scheduler {
 	/*! Helper class for dispatching parallel tasks
-	 * It uses an internal io_service and a group of threads that take care of executing the
+	 * It owns a WorkStealingPool with one worker per core that takes care of executing the
 	 * given tasks. Every io_service shares the same ParallelExecutionService service, this
 	 * is all handled by boost::asio.
 	 */
@@ -191,32 +270,43 @@ class Scheduler {
 		static boost::asio::io_service::id id;
 
 		ParallelExecutionService(boost::asio::io_service& ioService) :
-			boost::asio::io_service::service(ioService),
-			dummyWork(boost::asio::io_service::work(workerIoService))
-		{
-			for(int i = 0, max = boost::thread::hardware_concurrency(); i < max; ++i)
-				threadPool.create_thread(
-						boost::bind(&boost::asio::io_service::run, &workerIoService));
-		}
+			boost::asio::io_service::service(ioService)
+		{}
 
 		void shutdown_service() override {}
 
-		~ParallelExecutionService()
+		/*! Tasks posted from a worker thread are queued in its own deque
+		 * The queue depth and the time the task waits to start are recorded in SchedulerStats.
+		 */
+		template <class Task>
+		void post(Task&& task)
 		{
-			workerIoService.stop();
-			threadPool.join_all();
+			if(!SchedulerStats::isEnabled())
+				return pool.post(std::forward<Task>(task));
+
+			SchedulerStats::recordQueueDepth(pool.queued());
+			auto posted = SchedulerStats::Clock::now();
+			typename std::decay<Task>::type fn(std::forward<Task>(task));
+			pool.post([posted, fn]() mutable {
+				SchedulerStats::recordPoolWait(SchedulerStats::microsecondsSince(posted));
+				fn();
+			});
 		}
 
-		template <class Task>
-		void post(Task&& task)
+		/// Number of worker threads
+		std::size_t size() const
+		{
+			return pool.size();
+		}
+
+		/// Number of tasks queued and not yet taken by a worker
+		std::size_t queued() const
 		{
-			workerIoService.post(std::forward<Task>(task));
+			return pool.queued();
 		}
 
 	private:
-		boost::asio::io_service workerIoService;
-		boost::asio::io_service::work dummyWork;
-		boost::thread_group threadPool;
+		WorkStealingPool pool;
 	};
 
 public:
@@ -224,6 +314,14 @@ public:
 
 	Scheduler(boost::asio::io_service& ioService_) :
 		ioService(ioService_),
+		timerEngine(nullptr),
+		parallelService(boost::asio::use_service<ParallelExecutionService>(ioService_))
+	{}
+
+	/// Times every deferred and interval task with the given engine
+	Scheduler(boost::asio::io_service& ioService_, TimerEngine& timerEngine_) :
+		ioService(ioService_),
+		timerEngine(&timerEngine_),
 		parallelService(boost::asio::use_service<ParallelExecutionService>(ioService_))
 	{}
 
@@ -236,30 +334,35 @@ public:
 	}
 
 	template <class Func>
-	DeferredTaskPtr callAfter(int millisec, Func&& fn)
+	DeferredTaskPtr callAfter(int millisec, Func&& fn, const char* tag = nullptr)
 	{
-		return makeDeferred(millisec, std::forward<Func>(fn));
+		return makeDeferred(millisec, std::forward<Func>(fn), tag);
 	}
 
 	template <class Check, class Func>
-	DeferredTaskPtr callAfterIf(int millisec, Check&& check, Func&& fn)
+	DeferredTaskPtr callAfterIf(int millisec, Check&& check, Func&& fn,
+			const char* tag = nullptr)
 	{
-		return makeDeferred(millisec, [check, fn]() mutable { if(check) fn(); });
+		return makeDeferred(millisec, [check, fn]() mutable { if(check) fn(); }, tag);
 	}
 
 	template <class Func>
-	IntervalTaskPtr callEvery(int millisec, Func&& fn)
+	IntervalTaskPtr callEvery(int millisec, Func&& fn, const char* tag = nullptr)
 	{
-		return makeInterval(millisec, std::forward<Func>(fn));
+		return makeInterval(millisec, std::forward<Func>(fn), tag);
 	}
 
 	template <class Check, class Func>
-	IntervalTaskPtr callEveryIf(int millisec, Check&& check, Func&& fn)
+	IntervalTaskPtr callEveryIf(int millisec, Check&& check, Func&& fn,
+			const char* tag = nullptr)
 	{
-		return makeInterval(millisec, [check, fn]() mutable { if(check) fn(); });
+		return makeInterval(millisec, [check, fn]() mutable { if(check) fn(); }, tag);
 	}
 
-	/// Executes fn in a worker thread
+	/*! Executes fn in a worker thread
+	 * Calls made from a worker thread (i.e. from a parallel task) queue fn in the same worker,
+	 * idle workers steal it if the spawning one is busy.
+	 */
 	template <class Func>
 	void callInParallel(Func&& fn)
 	{
@@ -277,6 +380,31 @@ public:
 		});
 	}
 
+	/*! Calls fn(i) for every i in [begin, end) in the worker threads, then calls onDone in the
+	 * caller thread
+	 * The range is split adaptively between the workers, grain being the smallest chunk
+	 * worth a task of its own. The io_service is kept busy until onDone is called, if fn
+	 * throws the first exception is rethrown from the io_service instead. See parallelFor().
+	 * 		scheduler.parallelFor(0, monsters.size(), 1,
+	 * 			[&](std::size_t i){ monsters[i]->findPath(); }, [&]{ moveMonsters(); });
+	 */
+	template <class Func, class Callback>
+	void parallelFor(std::size_t begin, std::size_t end, std::size_t grain, Func&& fn,
+			Callback&& onDone)
+	{
+		otservpp::parallelFor(parallelService, ioService, begin, end, grain,
+				std::forward<Func>(fn), std::forward<Callback>(onDone));
+	}
+
+	/// Executes every task in the worker threads and calls onDone in the caller thread when
+	/// all of them are finished, same as parallelFor()
+	template <class Callback>
+	void whenAll(std::vector<std::function<void()>> tasks, Callback&& onDone)
+	{
+		otservpp::whenAll(parallelService, ioService, std::move(tasks),
+				std::forward<Callback>(onDone));
+	}
+
 private:
 	template <class Func>
 	struct Wrapper{
@@ -298,22 +426,184 @@ private:
 		Func func;
 	};
 
+	friend class TaskGroup;
+
+	template <class Func>
+	DeferredTaskPtr makeDeferred(int ms, Func&& task, const char* tag)
+	{
+		return makeDeferredRaw(ms, Wrapper<Func>(std::forward<Func>(task)), tag);
+	}
+
+	template <class Func>
+	IntervalTaskPtr makeInterval(int ms, Func&& task, const char* tag)
+	{
+		return makeIntervalRaw(ms, Wrapper<Func>(std::forward<Func>(task)), tag);
+	}
+
+	/// Makes a task with one of the DeferredTask signatures, timed by the engine if any
 	template <class Func>
-	DeferredTaskPtr makeDeferred(int ms, Func&& task)
+	DeferredTaskPtr makeDeferredRaw(int ms, Func&& task, const char* tag)
 	{
-		return makeDeferredTask(ioService, ms, Wrapper<Func>(std::forward<Func>(task)));
+		if(timerEngine)
+			return makeDeferredTask(*timerEngine, ms, std::forward<Func>(task), tag);
+		return makeDeferredTask(ioService, ms, std::forward<Func>(task), tag);
 	}
 
+	/// Makes a task with one of the IntervalTask signatures, timed by the engine if any
 	template <class Func>
-	IntervalTaskPtr makeInterval(int ms, Func&& task)
+	IntervalTaskPtr makeIntervalRaw(int ms, Func&& task, const char* tag)
 	{
-		return makeIntervalTask(ioService, ms, Wrapper<Func>(std::forward<Func>(task)));
+		if(timerEngine)
+			return makeIntervalTask(*timerEngine, ms, std::forward<Func>(task), tag);
+		return makeIntervalTask(ioService, ms, std::forward<Func>(task), tag);
 	}
 
 	boost::asio::io_service& ioService;
+	TimerEngine* timerEngine;
 	ParallelExecutionService& parallelService;
 };
 
+/*! Tasks scheduled on behalf of an owner (e.g. a creature or a player)
+ * Canceling or destroying the group invalidates every task scheduled through it at once,
+ * without canceling their timers: the functions of the tasks are owned by a block of the
+ * group, the tasks themselves only reach them through weak pointers. Canceling drops the
+ * block, so whatever the functions captured is freed right away even if their timers are far
+ * from expiring, and the timers do nothing when they do. Interval tasks stop at their next
+ * execution. This way owners don't need to keep and cancel the handles of their tasks one by
+ * one.
+ *
+ * Freeing the functions makes cancel() linear in the number of pending tasks. Scheduling a
+ * task takes three pooled allocations (the function, the ticket the timer holds and the
+ * block's list node) and locks the group's mutex, which is also taken when a timer finishes
+ * with its task.
+ *
+ * The group can still be used after being canceled, only the tasks scheduled before that are
+ * invalidated.
+ */
+class TaskGroup{
+public:
+	explicit TaskGroup(Scheduler& scheduler_) :
+		scheduler(scheduler_),
+		block(std::make_shared<Block>())
+	{}
+
+	~TaskGroup()
+	{
+		cancel();
+	}
+
+	template <class Func>
+	DeferredTaskPtr callAfter(int millisec, Func&& fn, const char* tag = nullptr)
+	{
+		return scheduler.makeDeferred(millisec, makeTask(std::forward<Func>(fn)), tag);
+	}
+
+	template <class Func>
+	IntervalTaskPtr callEvery(int millisec, Func&& fn, const char* tag = nullptr)
+	{
+		auto task = makeTask(std::forward<Func>(fn));
+		return scheduler.makeIntervalRaw(millisec,
+			[task](const SystemErrorCode& e, IntervalTask* this_) mutable {
+				if(!task.isValid())
+					this_->cancel();
+				else if(!e)
+					task();
+				else if(e != boost::asio::error::operation_aborted)
+					throw boost::system::system_error(e);
+			}, tag);
+	}
+
+	/// Invalidates every task scheduled in this group so far, freeing their functions (linear
+	/// in the number of pending tasks)
+	void cancel()
+	{
+		// the old block (and the functions) is destroyed once the new one is in place, so
+		// their destructors can already schedule new tasks
+		block = std::make_shared<Block>();
+	}
+
+	/// Number of tasks scheduled since the last cancel() whose timers are still around
+	std::size_t size()
+	{
+		std::lock_guard<std::mutex> lock(block->mutex);
+		return block->funcs.size();
+	}
+
+	TaskGroup(TaskGroup&) = delete;
+	void operator=(TaskGroup&) = delete;
+
+private:
+	typedef std::list<std::shared_ptr<void>, PoolAllocator<std::shared_ptr<void>>> FuncList;
+
+	/// Owns the functions of the tasks scheduled since the last cancel()
+	struct Block{
+		std::mutex mutex;
+		FuncList funcs;
+	};
+
+	/*! Shared by the copies of a task
+	 * The last copy goes away with the timer (after running, or when the timer is canceled or
+	 * destroyed), and takes the function out of the block if it's still the group's.
+	 */
+	template <class Func>
+	struct Ticket{
+		~Ticket()
+		{
+			auto owner = block.lock();
+			if(!owner) return;
+
+			// destroyed after unlocking, the function may schedule in this group
+			std::shared_ptr<void> unlinked;
+
+			std::lock_guard<std::mutex> lock(owner->mutex);
+			unlinked = std::move(*pos);
+			owner->funcs.erase(pos);
+		}
+
+		std::weak_ptr<Block> block;
+		std::weak_ptr<Func> func;
+		FuncList::iterator pos;
+	};
+
+	template <class Func>
+	struct Task{
+		bool isValid() const
+		{
+			return !ticket->func.expired();
+		}
+
+		void operator()()
+		{
+			// a cancel() made by func itself doesn't free it while it runs
+			if(auto func = ticket->func.lock())
+				(*func)();
+		}
+
+		std::shared_ptr<Ticket<Func>> ticket;
+	};
+
+	template <class Func>
+	Task<typename std::decay<Func>::type> makeTask(Func&& fn)
+	{
+		typedef typename std::decay<Func>::type FuncType;
+
+		auto func = std::allocate_shared<FuncType>(PoolAllocator<FuncType>(),
+				std::forward<Func>(fn));
+		auto ticket = std::allocate_shared<Ticket<FuncType>>(PoolAllocator<Ticket<FuncType>>());
+		ticket->func = func;
+
+		std::lock_guard<std::mutex> lock(block->mutex);
+		ticket->pos = block->funcs.insert(block->funcs.end(), std::move(func));
+		// only now the ticket can take the function out again
+		ticket->block = block;
+
+		return {std::move(ticket)};
+	}
+
+	Scheduler& scheduler;
+	std::shared_ptr<Block> block;
+};
+
 } /* namespace otservpp */
 
 #endif // OTSERVPP_SCHEDULER_HPP_
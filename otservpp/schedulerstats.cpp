@@ -0,0 +1,222 @@
+#include "schedulerstats.h"
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+namespace otservpp {
+
+std::size_t Histogram::bucketOf(uint64_t value)
+{
+	if(value == 0)
+		return 0;
+
+	return std::min<std::size_t>(64 - __builtin_clzll(value), Buckets-1);
+}
+
+void Histogram::add(uint64_t value)
+{
+	++count;
+	sum += value;
+	max = std::max(max, value);
+	++buckets[bucketOf(value)];
+}
+
+void Histogram::merge(const Histogram& other)
+{
+	count += other.count;
+	sum += other.sum;
+	max = std::max(max, other.max);
+	for(std::size_t i = 0; i < Buckets; ++i)
+		buckets[i] += other.buckets[i];
+}
+
+uint64_t Histogram::percentile(double p) const
+{
+	if(count == 0)
+		return 0;
+
+	auto rank = (uint64_t)(p*count/100);
+	uint64_t seen = 0;
+	for(std::size_t i = 0; i < Buckets; ++i){
+		seen += buckets[i];
+		if(seen > rank || seen == count)
+			return i == 0? 0 : std::min(max, ((uint64_t)1 << i) - 1);
+	}
+
+	return max;
+}
+
+const char* const SchedulerStats::Untagged = "<untagged>";
+const char* const SchedulerStats::Overflow = "<overflow>";
+
+std::atomic<bool> SchedulerStats::enabled {true};
+
+namespace{
+
+/*! Histogram written only by the thread owning it and read by anyone
+ * A load and a store is all the owner needs, relaxed atomics just keep the readers defined.
+ */
+class AtomicHistogram{
+public:
+	void add(uint64_t value)
+	{
+		bump(count, 1);
+		bump(sum, value);
+		if(value > max.load(std::memory_order_relaxed))
+			max.store(value, std::memory_order_relaxed);
+		bump(buckets[Histogram::bucketOf(value)], 1);
+	}
+
+	void addTo(Histogram& h) const
+	{
+		Histogram own;
+		own.count = count.load(std::memory_order_relaxed);
+		own.sum = sum.load(std::memory_order_relaxed);
+		own.max = max.load(std::memory_order_relaxed);
+		for(std::size_t i = 0; i < Histogram::Buckets; ++i)
+			own.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+		h.merge(own);
+	}
+
+private:
+	typedef std::atomic<uint64_t> Counter;
+
+	static void bump(Counter& c, uint64_t n)
+	{
+		c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	Counter count {0};
+	Counter sum {0};
+	Counter max {0};
+	std::array<Counter, Histogram::Buckets> buckets {{}};
+};
+
+/// The measurements of one thread
+struct Shard{
+	Shard()
+	{
+		for(auto& tag : tags)
+			tag.store(nullptr, std::memory_order_relaxed);
+	}
+
+	/// Histogram of tag, claiming a free slot the first time it's seen
+	AtomicHistogram& runtime(const char* tag)
+	{
+		auto first = ((uintptr_t)tag >> 3) % SchedulerStats::MaxTags;
+		for(std::size_t i = 0; i < SchedulerStats::MaxTags; ++i){
+			auto slot = (first+i) % SchedulerStats::MaxTags;
+			auto current = tags[slot].load(std::memory_order_relaxed);
+			if(current == tag)
+				return runtimes[slot];
+
+			if(!current){
+				// readers only look at the histogram after seeing its tag
+				tags[slot].store(tag, std::memory_order_release);
+				return runtimes[slot];
+			}
+		}
+
+		return overflow;
+	}
+
+	void addTo(SchedulerStats::Snapshot& snapshot) const
+	{
+		lateness.addTo(snapshot.lateness);
+		poolWait.addTo(snapshot.poolWait);
+		queueDepth.addTo(snapshot.queueDepth);
+
+		for(std::size_t i = 0; i < SchedulerStats::MaxTags; ++i){
+			if(auto tag = tags[i].load(std::memory_order_acquire))
+				runtimes[i].addTo(snapshot.runtimes[tag]);
+		}
+
+		Histogram overflowed;
+		overflow.addTo(overflowed);
+		if(overflowed.count > 0)
+			snapshot.runtimes[SchedulerStats::Overflow].merge(overflowed);
+	}
+
+	AtomicHistogram lateness;
+	AtomicHistogram poolWait;
+	AtomicHistogram queueDepth;
+	std::array<std::atomic<const char*>, SchedulerStats::MaxTags> tags;
+	std::array<AtomicHistogram, SchedulerStats::MaxTags> runtimes;
+	AtomicHistogram overflow;
+};
+
+/// Every live shard, plus what the finished threads recorded
+struct Registry{
+	std::mutex mutex;
+	std::vector<const Shard*> shards;
+	SchedulerStats::Snapshot retired;
+};
+
+Registry& registry()
+{
+	static Registry instance;
+	return instance;
+}
+
+/// Registers the shard of its thread, and retires it when the thread finishes
+class LocalShard{
+public:
+	LocalShard()
+	{
+		auto& r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		r.shards.push_back(&shard);
+	}
+
+	~LocalShard()
+	{
+		auto& r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		shard.addTo(r.retired);
+		r.shards.erase(std::find(r.shards.begin(), r.shards.end(), &shard));
+	}
+
+	Shard shard;
+};
+
+Shard& localShard()
+{
+	thread_local LocalShard local;
+	return local.shard;
+}
+
+} /* namespace */
+
+void SchedulerStats::recordLateness(uint64_t us)
+{
+	localShard().lateness.add(us);
+}
+
+void SchedulerStats::recordRuntime(const char* tag, uint64_t us)
+{
+	localShard().runtime(tag? tag : Untagged).add(us);
+}
+
+void SchedulerStats::recordPoolWait(uint64_t us)
+{
+	localShard().poolWait.add(us);
+}
+
+void SchedulerStats::recordQueueDepth(uint64_t depth)
+{
+	localShard().queueDepth.add(depth);
+}
+
+SchedulerStats::Snapshot SchedulerStats::snapshot()
+{
+	auto& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+
+	auto snapshot = r.retired;
+	for(auto shard : r.shards)
+		shard->addTo(snapshot);
+
+	return snapshot;
+}
+
+} /* namespace otservpp */
@@ -0,0 +1,109 @@
+#ifndef OTSERVPP_SCHEDULERSTATS_H_
+#define OTSERVPP_SCHEDULERSTATS_H_
+
+#include <map>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+namespace otservpp {
+
+/*! Histogram with power of two buckets
+ * Bucket 0 counts the zeros and bucket i the values in [2^(i-1), 2^i), the last one also
+ * counts anything bigger. Good enough to tell a 1ms hiccup from a 100ms one.
+ */
+struct Histogram{
+	enum{ Buckets = 40 };
+
+	uint64_t count {0};
+	uint64_t sum {0};
+	uint64_t max {0};
+	std::array<uint64_t, Buckets> buckets {{}};
+
+	/// Bucket in which value is counted
+	static std::size_t bucketOf(uint64_t value);
+
+	void add(uint64_t value);
+
+	void merge(const Histogram& other);
+
+	uint64_t average() const
+	{
+		return count? sum/count : 0;
+	}
+
+	/// Upper bound of the bucket holding the given percentile, in [0, 100]
+	uint64_t percentile(double p) const;
+};
+
+/*! Measurements of the scheduler, always on
+ * Timed tasks (DeferredTask and IntervalTask, thus the Scheduler and TaskGroup ones) record
+ * how late they fire, i.e. the time they start running minus their deadline, and how long
+ * they run, by tag. Parallel tasks record how long they wait in the pool and how many tasks
+ * were queued when they were posted. Times are in microseconds.
+ *
+ * Tags are static names given when scheduling, e.g.
+ * 		scheduler.callEvery(1000, [this]{ think(); }, "monster.think");
+ * they are told apart by address, so they must outlive the program (string literals do).
+ * Tasks without a tag are recorded as Untagged.
+ *
+ * Every thread records in its own shard with relaxed atomics and no locks, snapshot() sums
+ * them up; the shards of finished threads are kept. Snapshots are cumulative, compare two of
+ * them to get the figures of an interval.
+ *
+ * \note All the functions in this class are thread-safe
+ */
+class SchedulerStats{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	/// Distinct tags recorded per thread, any other goes to Overflow
+	enum{ MaxTags = 64 };
+
+	static const char* const Untagged;
+	static const char* const Overflow;
+
+	struct Snapshot{
+		Histogram lateness;
+		std::map<std::string, Histogram> runtimes;
+		Histogram poolWait;
+		Histogram queueDepth;
+	};
+
+	static bool isEnabled()
+	{
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	/// Recording is disabled while false, snapshots keep working
+	static void setEnabled(bool enable)
+	{
+		enabled = enable;
+	}
+
+	static void recordLateness(uint64_t us);
+
+	/// tag must have static storage duration, nullptr means Untagged
+	static void recordRuntime(const char* tag, uint64_t us);
+
+	static void recordPoolWait(uint64_t us);
+
+	static void recordQueueDepth(uint64_t depth);
+
+	static Snapshot snapshot();
+
+	static uint64_t microsecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+				Clock::now() - start).count();
+	}
+
+private:
+	static std::atomic<bool> enabled;
+};
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_SCHEDULERSTATS_H_
@@ -15,7 +15,7 @@ void SchedulerAdapter::apply(lua_State* L){
 		@ret DeferredTask a handle to the task future execution
 	 */
 	 def("callAfter", [this](int ms, const object& func){
-		return scheduler.callAfter(ms, [func]{ call_function<void>(func); });
+		return scheduler.callAfter(ms, [func]{ call_function<void>(func); }, "lua.callAfter");
 	 }),
 
 	 /*--Calls func every interval milliseconds.
@@ -25,7 +25,17 @@ void SchedulerAdapter::apply(lua_State* L){
 		@ret IntervalTask a handle to the continuous execution
 	 */
 	 def("callEvery", [this](int ms, const object& func) {
-		return scheduler.callEvery(ms, [func]{ call_function<void>(func); });
+		return scheduler.callEvery(ms, [func]{ call_function<void>(func); }, "lua.callEvery");
+	 }),
+
+	 /*--Creates an empty group of tasks.
+		Every task scheduled through the group is canceled at once when the group is canceled
+		or garbage collected.
+		@function newTaskGroup
+		@ret TaskGroup the new group
+	 */
+	 def("newTaskGroup", [this]{
+		return std::make_shared<otservpp::TaskGroup>(scheduler);
 	 })
 	];
 }
@@ -9,7 +9,7 @@ OTSERVPP_NAMESPACE_SCRIPT_BEGIN
 class SchedulerAdapter : public GlobalInstanceAdapter<otservpp::Scheduler>{
 public:
 	SchedulerAdapter(otservpp::Scheduler& s) :
-		GlobalInstanceAdapter<otservpp::Scheduler>("[callAfter(), callEvery()]"),
+		GlobalInstanceAdapter<otservpp::Scheduler>("[callAfter(), callEvery(), newTaskGroup()]"),
 		scheduler(s)
 	{}
 
@@ -58,3 +58,57 @@ OTSERVPP_STATIC_ADAPTER_T(IntervalTaskAdapter, otservpp::IntervalTask){
 		 .def("reschedule", (void(IntervalTask::*)(int))&IntervalTask::reschedule)
 	];
 }
+
+namespace{
+
+otservpp::DeferredTaskPtr groupCallAfter(otservpp::TaskGroup& group, int ms, const object& func)
+{
+	return group.callAfter(ms, [func]{ call_function<void>(func); }, "lua.callAfter");
+}
+
+otservpp::IntervalTaskPtr groupCallEvery(otservpp::TaskGroup& group, int ms, const object& func)
+{
+	return group.callEvery(ms, [func]{ call_function<void>(func); }, "lua.callEvery");
+}
+
+}
+
+OTSERVPP_STATIC_ADAPTER_T(TaskGroupAdapter, otservpp::TaskGroup){
+	using otservpp::TaskGroup;
+	module(L)
+	[
+	 /*--Tasks that are canceled together, i.e. the ones of a creature
+		 You cannot create instances of this class directly, use @{newTaskGroup} instead.
+		 Keep a reference to the group as long as its tasks should run.
+		 @type TaskGroup
+	  */
+	 class_<TaskGroup, otservpp::TaskGroupPtr>("TaskGroup")
+		 /*--Calls func after ms milliseconds from now, unless the group is canceled before.
+			@function callAfter
+			@p number ms milliseconds to wait before calling func
+			@p function func the function to be called
+			@ret DeferredTask a handle to the task future execution
+		  */
+		 .def("callAfter", &groupCallAfter)
+
+		 /*--Calls func every interval milliseconds until the group is canceled.
+			@function callEvery
+			@p number interval Milliseconds to wait between calls to func
+			@p function func the function to be called
+			@ret IntervalTask a handle to the continuous execution
+		  */
+		 .def("callEvery", &groupCallEvery)
+
+		 /*--Cancels every task scheduled in this group so far
+			Their functions (and whatever they hold) are released right away. The group can
+			still be used to schedule new tasks.
+			@function cancel
+			@usage
+				local tasks = newTaskGroup()
+				tasks:callAfter(1000, function() print("nope") end)
+				tasks:callEvery(500, function() print("nope") end)
+				tasks:cancel() -- nothing is printed
+		  */
+		 .def("cancel", &TaskGroup::cancel)
+	];
+}
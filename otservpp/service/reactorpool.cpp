@@ -0,0 +1,78 @@
+#include "reactorpool.h"
+#include <algorithm>
+#include <glog/logging.h>
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+namespace otservpp {
+
+boost::asio::io_service::id ReactorLoad::id;
+
+namespace{
+
+void pinToCore(boost::thread& thread, unsigned core)
+{
+#ifdef __linux__
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(core, &cpus);
+
+	if(pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus) != 0)
+		LOG(WARNING) << "couldn't pin reactor thread to core " << core;
+#endif
+}
+
+}
+
+ReactorPool::ReactorPool(unsigned reactorCount)
+{
+	auto cores = std::max(boost::thread::hardware_concurrency(), 1u);
+
+	if(reactorCount == 0)
+		reactorCount = cores;
+
+	for(unsigned i = 0; i < reactorCount; ++i)
+		reactors.emplace_back(new Reactor);
+}
+
+ReactorPool::~ReactorPool()
+{
+	stop();
+	join();
+}
+
+void ReactorPool::start()
+{
+	auto cores = std::max(boost::thread::hardware_concurrency(), 1u);
+
+	for(std::size_t i = 0; i < reactors.size(); ++i){
+		auto& ioService = reactors[i]->ioService;
+		auto thread = threads.create_thread([&ioService]{ ioService.run(); });
+		pinToCore(*thread, i % cores);
+	}
+}
+
+void ReactorPool::stop()
+{
+	for(auto& reactor : reactors)
+		reactor->ioService.stop();
+}
+
+void ReactorPool::join()
+{
+	threads.join_all();
+}
+
+boost::asio::io_service& ReactorPool::leastLoaded()
+{
+	auto best = reactors.front().get();
+
+	for(auto& reactor : reactors)
+		if(reactor->load.getConnectionCount() < best->load.getConnectionCount())
+			best = reactor.get();
+
+	return best->ioService;
+}
+
+} /* namespace otservpp */
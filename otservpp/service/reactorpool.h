@@ -0,0 +1,114 @@
+#ifndef OTSERVPP_REACTORPOOL_H_
+#define OTSERVPP_REACTORPOOL_H_
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <boost/thread/thread.hpp>
+#include "../networkdcl.hpp"
+
+namespace otservpp {
+
+/*! Counts the live connections multiplexed by an io_service
+ * Connections hold a Token during their lifetime, ReactorPool uses the count for balancing.
+ */
+class ReactorLoad : public boost::asio::io_service::service{
+public:
+	/// RAII registration of a connection
+	class Token{
+	public:
+		explicit Token(boost::asio::io_service& ioService) :
+			load(boost::asio::use_service<ReactorLoad>(ioService))
+		{
+			load.connections.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		~Token()
+		{
+			load.connections.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		Token(Token&) = delete;
+		void operator=(Token&) = delete;
+
+	private:
+		ReactorLoad& load;
+	};
+
+	static boost::asio::io_service::id id;
+
+	explicit ReactorLoad(boost::asio::io_service& ioService) :
+		boost::asio::io_service::service(ioService)
+	{}
+
+	void shutdown_service() override {}
+
+	/// Number of connections currently alive
+	int getConnectionCount() const
+	{
+		return connections.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<int> connections {0};
+};
+
+/*! A set of io_services each one run by its own thread
+ * ServiceManager hands every accepted connection to leastLoaded(), the reactor with the
+ * smallest number of live connections at that moment. Each thread is pinned to a different
+ * core when possible, this way network IO and strand work scale across cores without
+ * contending on a single io_service.
+ */
+class ReactorPool{
+public:
+	/// Creates a pool with the given number of reactors, 0 means one per hardware thread
+	explicit ReactorPool(unsigned reactorCount = 0);
+
+	/// Stops and joins every reactor thread
+	~ReactorPool();
+
+	/// Starts running every reactor in its own thread
+	void start();
+
+	/// Makes every reactor return as soon as possible, see io_service::stop()
+	void stop();
+
+	/// Waits for every reactor thread to finish
+	void join();
+
+	std::size_t size() const
+	{
+		return reactors.size();
+	}
+
+	boost::asio::io_service& operator[](std::size_t i)
+	{
+		return reactors[i]->ioService;
+	}
+
+	/// Returns the io_service with the less live connections
+	/// \note This function is thread-safe
+	boost::asio::io_service& leastLoaded();
+
+	ReactorPool(ReactorPool&) = delete;
+	void operator=(ReactorPool&) = delete;
+
+private:
+	struct Reactor{
+		Reactor() :
+			load(boost::asio::use_service<ReactorLoad>(ioService)),
+			work(ioService)
+		{}
+
+		boost::asio::io_service ioService;
+		ReactorLoad& load;
+		boost::asio::io_service::work work;
+	};
+
+	std::vector<std::unique_ptr<Reactor>> reactors;
+	boost::thread_group threads;
+};
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_REACTORPOOL_H_
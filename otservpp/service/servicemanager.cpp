@@ -1,4 +1,5 @@
 #include "servicemanager.h"
+#include <glog/logging.h>
 #include <boost/lexical_cast.hpp>
 #include "service.hpp"
 
@@ -7,23 +8,47 @@ using namespace boost::asio::ip;
 
 namespace otservpp {
 
+namespace{
+
+#ifdef SO_REUSEPORT
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> ReusePortOption;
+#endif
+
+/// Accept retry delays in milliseconds
+enum{
+	MinRetryDelay = 10,
+	MaxRetryDelay = 1000
+};
+
+}
+
 ServiceManager::ServiceManager(boost::asio::io_service& ioService_) :
-	ioService(ioService_)
+	ioService(ioService_),
+	reactors(nullptr)
+{}
+
+ServiceManager::ServiceManager(boost::asio::io_service& ioService_, ReactorPool& reactors_) :
+	ioService(ioService_),
+	reactors(&reactors_)
 {}
 
 void ServiceManager::start()
 {
-	// start listening on all acceptors
-	for(auto& portNService : serviceMap){
-		auto& acceptor = portNService.second.acceptor;
-		tcp::endpoint endpoint {tcp::v4(), portNService.first};
+	bool useReusePort = reusePort && reactors;
 
-		acceptor.open(endpoint.protocol());
-		acceptor.set_option(boost::asio::socket_base::reuse_address(true));
-		acceptor.bind(endpoint);
-		acceptor.listen();
+#ifndef SO_REUSEPORT
+	LOG_IF(WARNING, useReusePort) << "SO_REUSEPORT isn't supported, using a single acceptor";
+	useReusePort = false;
+#endif
 
-		acceptMore(portNService.second);
+	// start listening on all acceptors
+	for(auto& portNService : serviceMap){
+		if(useReusePort){
+			for(std::size_t i = 0; i < reactors->size(); ++i)
+				listen(portNService.second, (*reactors)[i], true);
+		} else {
+			listen(portNService.second, ioService, false);
+		}
 	}
 }
 
@@ -31,21 +56,111 @@ void ServiceManager::registerService(ServiceUniquePtr&& svc)
 {
 	ServiceUniquePtr::pointer svcp = svc.get();
 
-	if(!serviceMap.insert(make_pair(svcp->getPort(), PrivateService(move(svc), ioService))).second)
+	if(!serviceMap.insert(make_pair(svcp->getPort(), PrivateService(move(svc)))).second)
 		throw runtime_error("trying to register service " + svcp->getName()
 				+ " with a duplicated port " + boost::lexical_cast<string>(svcp->getPort()));
 }
 
-void ServiceManager::acceptMore(PrivateService& svc)
+void ServiceManager::setReusePort(bool reusePort_)
+{
+	reusePort = reusePort_;
+}
+
+void ServiceManager::setPendingAccepts(unsigned pendingAccepts_)
+{
+	pendingAccepts = std::max(pendingAccepts_, 1u);
+}
+
+boost::asio::io_service& ServiceManager::nextConnectionIoService()
+{
+	return reactors? reactors->leastLoaded() : ioService;
+}
+
+void ServiceManager::listen(PrivateService& svc, boost::asio::io_service& acceptorIo,
+		bool reuseAcceptorIo)
+{
+	svc.listeners.emplace_back(new Listener(acceptorIo, reuseAcceptorIo? &acceptorIo : nullptr));
+	auto& listener = *svc.listeners.back();
+	auto& acceptor = listener.acceptor;
+	tcp::endpoint endpoint {tcp::v4(), svc.service->getPort()};
+
+	acceptor.open(endpoint.protocol());
+	acceptor.set_option(boost::asio::socket_base::reuse_address(true));
+#ifdef SO_REUSEPORT
+	if(reuseAcceptorIo)
+		acceptor.set_option(ReusePortOption(true));
+#endif
+	acceptor.bind(endpoint);
+	acceptor.listen();
+
+	for(unsigned i = 0; i < pendingAccepts; ++i)
+		listener.accepts.emplace_back(new PendingAccept(acceptorIo));
+
+	// acceptorIo may be running already, and accept handlers call acceptMore() from there. The
+	// acceptor isn't thread-safe, so accepts are started from acceptorIo too
+	acceptorIo.post([this, &svc, &listener]{
+		for(auto& accept : listener.accepts)
+			acceptMore(svc, listener, *accept);
+	});
+}
+
+void ServiceManager::acceptMore(PrivateService& svc, Listener& listener, PendingAccept& accept)
 {
-	svc.acceptor.async_accept(svc.peer, [this, &svc](const SystemErrorCode& e){
+	accept.peer.reset(new tcp::socket(listener.ioService));
+
+	listener.acceptor.async_accept(*accept.peer,
+	[this, &svc, &listener, &accept](const SystemErrorCode& e){
 		if(!e){
-			svc.service->incomingConnection(move(svc.peer));
-			acceptMore(svc);
-		} else{
-			throw boost::system::system_error(e);
+			accept.retryDelay = 0;
+			handOff(svc, listener, *accept.peer);
+			acceptMore(svc, listener, accept);
+		} else if(e != boost::asio::error::operation_aborted){
+			retryAccept(svc, listener, accept, e);
 		}
 	});
 }
 
+void ServiceManager::handOff(PrivateService& svc, Listener& listener, tcp::socket& peer)
+{
+	auto& reactor = listener.reactor? *listener.reactor : nextConnectionIoService();
+	if(&reactor == &listener.ioService)
+		return svc.service->incomingConnection(move(peer));
+
+	// sockets can't change their io_service, but their descriptor can be adopted by another one
+	SystemErrorCode e;
+	auto protocol = peer.local_endpoint(e).protocol();
+	tcp::socket moved(reactor);
+
+	if(!e){
+		auto handle = peer.release(e);
+		if(!e)
+			moved.assign(protocol, handle, e);
+	}
+
+	if(e){
+		LOG(WARNING) << "couldn't hand off a connection of " << svc.service->getName() << ": "
+				<< e.message();
+		peer.close(e);
+		return;
+	}
+
+	svc.service->incomingConnection(move(moved));
+}
+
+void ServiceManager::retryAccept(PrivateService& svc, Listener& listener,
+		PendingAccept& accept, const SystemErrorCode& e)
+{
+	accept.retryDelay = accept.retryDelay?
+			std::min(accept.retryDelay*2, (int)MaxRetryDelay) : (int)MinRetryDelay;
+
+	LOG(WARNING) << "error accepting connections on " << svc.service->getName() << ": "
+			<< e.message() << ", retrying in " << accept.retryDelay << "ms";
+
+	accept.retryTimer.expires_from_now(boost::posix_time::millisec(accept.retryDelay));
+	accept.retryTimer.async_wait([this, &svc, &listener, &accept](const SystemErrorCode& e){
+		if(e != boost::asio::error::operation_aborted)
+			acceptMore(svc, listener, accept);
+	});
+}
+
 } /* namespace otservpp */
@@ -2,24 +2,37 @@
 #define OTSERVPP_SERVICEMANAGER_H_
 
 #include <map>
+#include <vector>
 #include "../networkdcl.hpp"
 #include "../forwarddcl.hpp"
 #include "service.hpp"
+#include "reactorpool.h"
 
 namespace otservpp {
 
 /*! Entry point of network connections.
  * This tiny class is used for dispatching new connections to their respective services.
+ *
+ * Sockets are multiplexed by asio's reactor (epoll on Linux). There's no io_uring transport,
+ * the asio version we build against (1.74) has none and a hand rolled one would replace the
+ * whole socket layer of Connection.
  */
 class ServiceManager {
 public:
+	/// Accepts and runs every connection in the given io_service
 	ServiceManager(boost::asio::io_service& ioService_);
 
+	/*! Accepts connections in the given io_service, but runs each one of them in the
+	 * least loaded reactor of the given pool
+	 */
+	ServiceManager(boost::asio::io_service& ioService_, ReactorPool& reactors_);
+
 	~ServiceManager() = default;
 
 	/*! Starts all the services registered with this manager
 	 * All the services will start listening in their respective port, but nothing will be
-	 * done until the io_service given in the constructor is ran.
+	 * done until the io_service given in the constructor (or the reactors) is ran. It's safe
+	 * to call this after the ReactorPool was started.
 	 * \warning This function should only be called once on startup
 	 */
 	void start();
@@ -31,31 +44,92 @@ public:
 	// TODO add support for late registering of services in multithreaded context
 	void registerService(ServiceUniquePtr&& service);
 
+	/*! Makes every service listen with one SO_REUSEPORT acceptor per reactor, each one
+	 * accepting connections for its own reactor. The kernel balances incoming connections
+	 * between the acceptors. Without a ReactorPool (or SO_REUSEPORT support) this does nothing
+	 * and a single acceptor is used.
+	 * \warning This function must be called before start()
+	 */
+	void setReusePort(bool reusePort);
+
+	/*! Number of accept operations every acceptor keeps outstanding, 1 by default
+	 * More than one lets a burst of connections be accepted without waiting for each accept
+	 * handler to start the next accept.
+	 * \warning This function must be called before start()
+	 */
+	void setPendingAccepts(unsigned pendingAccepts);
+
 	ServiceManager(ServiceManager&) = delete;
 	void operator=(ServiceManager&) = delete;
 
 private:
+	/// An outstanding accept operation
+	struct PendingAccept{
+		explicit PendingAccept(boost::asio::io_service& ioService) :
+			retryTimer(ioService)
+		{}
+
+		/// Created in the acceptor's io_service, see handOff()
+		std::unique_ptr<boost::asio::ip::tcp::socket> peer;
+		boost::asio::deadline_timer retryTimer;
+		int retryDelay {0};
+	};
+
+	/// A listening socket and its outstanding accepts
+	struct Listener{
+		Listener(boost::asio::io_service& ioService_, boost::asio::io_service* reactor_) :
+			ioService(ioService_),
+			acceptor(ioService_),
+			reactor(reactor_)
+		{}
+
+		boost::asio::io_service& ioService;
+		boost::asio::ip::tcp::acceptor acceptor;
+		/// Where accepted connections run, if null nextConnectionIoService() is used
+		boost::asio::io_service* reactor;
+		std::vector<std::unique_ptr<PendingAccept>> accepts;
+	};
+
 	/// This implements the network related data of a Service
 	struct PrivateService{
-		PrivateService(ServiceUniquePtr&& svc, boost::asio::io_service& ioService) :
-			service(std::move(svc)),
-			acceptor(ioService),
-			peer(ioService)
+		PrivateService(ServiceUniquePtr&& svc) :
+			service(std::move(svc))
 		{}
 
 		PrivateService(PrivateService&&) = default;
 
 		ServiceUniquePtr service;
-		boost::asio::ip::tcp::acceptor acceptor;
-		boost::asio::ip::tcp::socket peer;
+		std::vector<std::unique_ptr<Listener>> listeners;
 	};
 
 	typedef std::map<uint16_t, PrivateService> PortServiceMap;
 
+	/// Opens a new acceptor for the given service in acceptorIo
+	void listen(PrivateService& svc, boost::asio::io_service& acceptorIo, bool reuseAcceptorIo);
+
 	/// Maintains the connection dispatching flow
-	void acceptMore(PrivateService& svc);
+	void acceptMore(PrivateService& svc, Listener& listener, PendingAccept& accept);
+
+	/// Retries a failed accept after a growing delay, so errors like EMFILE don't stop the
+	/// service from listening
+	void retryAccept(PrivateService& svc, Listener& listener, PendingAccept& accept,
+			const SystemErrorCode& e);
+
+	/*! Passes a peer accepted by listener to the service, running it in the listener's
+	 * reactor or the least loaded one
+	 * Reactors are picked when a connection arrives, not when the accept is started, so a
+	 * burst of connections completing the outstanding accepts is spread by live connection
+	 * count. The descriptor is moved to a socket of the reactor if needed.
+	 */
+	void handOff(PrivateService& svc, Listener& listener, boost::asio::ip::tcp::socket& peer);
+
+	/// Returns the io_service where the next accepted connection will run
+	boost::asio::io_service& nextConnectionIoService();
 
 	boost::asio::io_service& ioService;
+	ReactorPool* reactors;
+	bool reusePort {false};
+	unsigned pendingAccepts {1};
 	PortServiceMap serviceMap;
 };
 
@@ -0,0 +1,185 @@
+#ifndef OTSERVPP_TIMERENGINE_HPP_
+#define OTSERVPP_TIMERENGINE_HPP_
+
+#include <cstdint>
+#include <functional>
+#include <boost/optional.hpp>
+#include "networkdcl.hpp"
+#include "inlinefunction.hpp"
+
+namespace otservpp {
+
+/*! Backend for the timers of DeferredTask and IntervalTask
+ * By default every task owns a boost::asio::deadline_timer, an engine replaces that by its
+ * own bookkeeping (e.g. a TimerWheel) while keeping the same observable behavior: handlers are
+ * always posted to the engine's io_service, either with a success code when the deadline
+ * expires or with operation_aborted when the wait is canceled.
+ *
+ * Engines keep intrusive entries and handlers are stored inline, so linking and unlinking
+ * a task never allocates.
+ */
+class TimerEngine{
+public:
+	enum{ HandlerInlineSize = 64 };
+
+	typedef InlineFunction<void(const SystemErrorCode&), HandlerInlineSize> Handler;
+
+	/// A pending wait, linked by the engine in one of its lists. Only engines touch this
+	struct Entry{
+		Entry* next {nullptr};
+		Entry** pprev {nullptr};
+		/// Expiration time in the engine's clock (see now())
+		uint64_t deadline {0};
+		Handler handler;
+	};
+
+	explicit TimerEngine(boost::asio::io_service& ioService_) :
+		ioService(ioService_)
+	{}
+
+	virtual ~TimerEngine() = default;
+
+	/// Current time, in milliseconds, of this engine's clock
+	virtual uint64_t now() = 0;
+
+	/// Links entry so handler is posted when entry.deadline expires
+	/// \note The entry must not be linked
+	virtual void add(Entry& entry, Handler&& handler) = 0;
+
+	/// Unlinks entry moving its handler to handler, returns false if it wasn't linked
+	virtual bool remove(Entry& entry, Handler& handler) = 0;
+
+	/// Unlinks entry and posts its handler with an operation_aborted error code
+	/// \return the number of handlers canceled, i.e. 0 or 1
+	std::size_t cancel(Entry& entry)
+	{
+		Handler handler;
+		if(!remove(entry, handler))
+			return 0;
+
+		post(std::move(handler), boost::asio::error::operation_aborted);
+		return 1;
+	}
+
+	boost::asio::io_service& getIoService()
+	{
+		return ioService;
+	}
+
+	TimerEngine(TimerEngine&) = delete;
+	void operator=(TimerEngine&) = delete;
+
+protected:
+	/// Makes handler be called with e from the engine's io_service
+	void post(Handler&& handler, const SystemErrorCode& e)
+	{
+		// asio accepts move-only handlers
+		boost::asio::post(ioService, std::bind(std::move(handler), e));
+	}
+
+	static bool isLinked(const Entry& entry)
+	{
+		return entry.pprev != nullptr;
+	}
+
+	static void link(Entry*& head, Entry& entry)
+	{
+		entry.next = head;
+		entry.pprev = &head;
+		if(head)
+			head->pprev = &entry.next;
+		head = &entry;
+	}
+
+	static void unlink(Entry& entry)
+	{
+		*entry.pprev = entry.next;
+		if(entry.next)
+			entry.next->pprev = entry.pprev;
+		entry.next = nullptr;
+		entry.pprev = nullptr;
+	}
+
+	boost::asio::io_service& ioService;
+};
+
+/*! The timer of a DeferredTask, either an asio deadline_timer or an entry in a TimerEngine
+ * It mimics the part of the deadline_timer interface used by the tasks: one pending wait at
+ * a time, changing the expiration time cancels the pending wait.
+ */
+class TaskTimer{
+public:
+	/// Uses a boost::asio::deadline_timer
+	explicit TaskTimer(boost::asio::io_service& ioService) :
+		engine(nullptr)
+	{
+		asioTimer.emplace(ioService);
+	}
+
+	/// Uses the given engine, which must outlive this timer
+	explicit TaskTimer(TimerEngine& engine_) :
+		engine(&engine_)
+	{}
+
+	~TaskTimer()
+	{
+		if(engine){
+			TimerEngine::Handler handler;
+			engine->remove(entry, handler);
+		}
+	}
+
+	/// Sets the expiration time, canceling the pending wait
+	/// \return the number of handlers canceled
+	std::size_t expiresFromNow(int ms)
+	{
+		if(!engine)
+			return asioTimer->expires_from_now(boost::posix_time::millisec(ms));
+
+		auto canceled = cancel();
+		entry.deadline = engine->now() + (ms > 0? ms : 0);
+		return canceled;
+	}
+
+	template <class Handler>
+	void asyncWait(Handler&& handler)
+	{
+		if(!engine)
+			asioTimer->async_wait(std::forward<Handler>(handler));
+		else
+			engine->add(entry, TimerEngine::Handler(std::forward<Handler>(handler)));
+	}
+
+	/// Cancels the pending wait, its handler is posted with an operation_aborted error code
+	/// \return the number of handlers canceled
+	std::size_t cancel()
+	{
+		return engine? engine->cancel(entry) : asioTimer->cancel();
+	}
+
+	/*! Microseconds elapsed since the expiration time, 0 if it isn't due yet
+	 * Engines only have millisecond precision.
+	 */
+	uint64_t lateness()
+	{
+		if(engine){
+			auto now = engine->now();
+			return now > entry.deadline? (now - entry.deadline)*1000 : 0;
+		}
+
+		auto late = boost::asio::deadline_timer::traits_type::now() - asioTimer->expires_at();
+		return late.is_negative()? 0 : late.total_microseconds();
+	}
+
+	TaskTimer(TaskTimer&) = delete;
+	void operator=(TaskTimer&) = delete;
+
+private:
+	TimerEngine* engine;
+	TimerEngine::Entry entry;
+	boost::optional<boost::asio::deadline_timer> asioTimer;
+};
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_TIMERENGINE_HPP_
@@ -0,0 +1,265 @@
+#include "timerwheel.h"
+#include <cassert>
+#include <algorithm>
+#include <glog/logging.h>
+
+namespace otservpp {
+
+boost::asio::io_service::id TimerWheel::id{};
+
+namespace{
+
+/// Handlers taken out of the wheel, the vector's capacity is kept between calls in each thread
+struct FiredHandlers{
+	FiredHandlers()
+	{
+		handlers.swap(cache());
+	}
+
+	~FiredHandlers()
+	{
+		handlers.clear();
+		handlers.swap(cache());
+	}
+
+	static std::vector<TimerEngine::Handler>& cache()
+	{
+		static thread_local std::vector<TimerEngine::Handler> handlers;
+		return handlers;
+	}
+
+	std::vector<TimerEngine::Handler> handlers;
+};
+
+}
+
+TimerWheel::TimerWheel(boost::asio::io_service& ioService) :
+	boost::asio::io_service::service(ioService),
+	TimerEngine(ioService),
+	start(Clock::now()),
+	driver(ioService)
+{
+	firstLevel.fill(nullptr);
+	for(auto& level : levels)
+		level.fill(nullptr);
+}
+
+void TimerWheel::shutdown_service()
+{
+	std::vector<Handler> handlers;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		clear(handlers);
+		SystemErrorCode ignored;
+		driver.cancel(ignored);
+		armed = false;
+	}
+	// destroying the handlers may destroy tasks, which remove() their entries
+	handlers.clear();
+}
+
+uint64_t TimerWheel::now()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now()-start).count();
+}
+
+void TimerWheel::add(Entry& entry, Handler&& handler)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	assert(!isLinked(entry));
+
+	// current only moves on wake ups, catch up with the idle time so the entry isn't placed
+	// (and the driver armed) relative to a stale tick
+	if(count == 0)
+		current = std::max(current, now());
+
+	// the current tick was already processed
+	entry.deadline = std::max(entry.deadline, current+1);
+	entry.handler = std::move(handler);
+	place(entry);
+	++count;
+
+	// entries in upper levels need the next cascade
+	uint64_t nextCascade = ((current >> FirstLevelBits) + 1) << FirstLevelBits;
+	arm(std::min(entry.deadline, nextCascade));
+}
+
+bool TimerWheel::remove(Entry& entry, Handler& handler)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if(!isLinked(entry))
+		return false;
+
+	unlink(entry);
+	--count;
+	handler = std::move(entry.handler);
+	return true;
+}
+
+std::size_t TimerWheel::size()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return count;
+}
+
+std::size_t TimerWheel::poll()
+{
+	FiredHandlers fired;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		advance(now(), fired.handlers);
+	}
+
+	for(auto& handler : fired.handlers){
+		try{
+			handler(SystemErrorCode());
+		} catch(std::exception& e){
+			LOG(ERROR) << "Uncaught exception in timer: " << e.what();
+		}
+	}
+
+	return fired.handlers.size();
+}
+
+void TimerWheel::setPolled(bool polled_)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	polled = polled_;
+
+	if(polled){
+		SystemErrorCode ignored;
+		driver.cancel(ignored);
+		armed = false;
+	} else if(count > 0){
+		arm(nextWakeUp());
+	}
+}
+
+void TimerWheel::place(Entry& entry)
+{
+	uint64_t expiry = entry.deadline;
+	assert(expiry >= current);
+	uint64_t delta = expiry - current;
+
+	if(delta < FirstLevelSize){
+		link(firstLevel[expiry & (FirstLevelSize-1)], entry);
+		return;
+	}
+
+	int level = 1;
+	while(level < Levels-1 && delta >= (uint64_t)1 << (FirstLevelBits + level*LevelBits))
+		++level;
+
+	// too far away, it will be placed again when its slot is cascaded
+	uint64_t span = (uint64_t)1 << (FirstLevelBits + level*LevelBits);
+	if(delta >= span)
+		expiry = current + span - 1;
+
+	int shift = FirstLevelBits + (level-1)*LevelBits;
+	link(levels[level-1][(expiry >> shift) & (LevelSize-1)], entry);
+}
+
+void TimerWheel::advance(uint64_t tick, std::vector<Handler>& fired)
+{
+	while(current < tick){
+		if(count == 0){
+			current = tick;
+			return;
+		}
+
+		++current;
+		auto index = current & (FirstLevelSize-1);
+		if(index == 0)
+			cascade(1);
+
+		Entry*& slot = firstLevel[index];
+		while(Entry* entry = slot){
+			unlink(*entry);
+			--count;
+			fired.push_back(std::move(entry->handler));
+		}
+	}
+}
+
+void TimerWheel::cascade(int level)
+{
+	int shift = FirstLevelBits + (level-1)*LevelBits;
+	auto index = (current >> shift) & (LevelSize-1);
+	if(index == 0 && level < Levels-1)
+		cascade(level+1);
+
+	Entry*& slot = levels[level-1][index];
+	Entry* entry = slot;
+	slot = nullptr;
+
+	while(entry){
+		Entry* next = entry->next;
+		entry->next = nullptr;
+		entry->pprev = nullptr;
+		place(*entry);
+		entry = next;
+	}
+}
+
+uint64_t TimerWheel::nextWakeUp()
+{
+	for(uint64_t tick = current+1;; ++tick){
+		auto index = tick & (FirstLevelSize-1);
+		// if the first level is empty the rest of the entries are waiting for a cascade
+		if(firstLevel[index] || index == 0)
+			return tick;
+	}
+}
+
+void TimerWheel::arm(uint64_t tick)
+{
+	if(polled || (armed && armedTick <= tick))
+		return;
+
+	armed = true;
+	armedTick = tick;
+	driver.expires_at(start + std::chrono::milliseconds(tick));
+	driver.async_wait([this](const SystemErrorCode& e){ onWakeUp(e); });
+}
+
+void TimerWheel::onWakeUp(const SystemErrorCode& e)
+{
+	if(e == boost::asio::error::operation_aborted)
+		return;
+
+	FiredHandlers fired;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		// the wait may have completed right before setPolled() canceled it
+		if(polled)
+			return;
+
+		armed = false;
+		advance(now(), fired.handlers);
+		if(count > 0)
+			arm(nextWakeUp());
+	}
+
+	for(auto& handler : fired.handlers)
+		post(std::move(handler), SystemErrorCode());
+}
+
+void TimerWheel::clear(std::vector<Handler>& handlers)
+{
+	auto unlinkAll = [&](Entry*& slot){
+		while(Entry* entry = slot){
+			unlink(*entry);
+			handlers.push_back(std::move(entry->handler));
+		}
+	};
+
+	for(auto& slot : firstLevel)
+		unlinkAll(slot);
+	for(auto& level : levels)
+		for(auto& slot : level)
+			unlinkAll(slot);
+
+	count = 0;
+}
+
+} /* namespace otservpp */
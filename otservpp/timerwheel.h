@@ -0,0 +1,104 @@
+#ifndef OTSERVPP_TIMERWHEEL_H_
+#define OTSERVPP_TIMERWHEEL_H_
+
+#include <array>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <boost/asio/steady_timer.hpp>
+#include "timerengine.hpp"
+
+namespace otservpp {
+
+/*! Hierarchical timing wheel with millisecond resolution
+ * Scheduling and canceling a task are O(1) no matter how many timers are alive, which is what
+ * makes hundreds of thousands of creature/decay/script timers affordable. The first level has
+ * one slot per millisecond for the next 256ms, each one of the upper levels has 64 slots
+ * covering 64 times the span of the previous level (i.e. up to ~49 days, farther deadlines
+ * are capped and re-cascaded). Whenever the first level wraps, the due slot of the next level
+ * is cascaded down.
+ *
+ * The wheel is driven by a single asio steady_timer, which only wakes up when there's a
+ * non empty slot (or a cascade) due. There's one wheel per io_service, get it with
+ * boost::asio::use_service<TimerWheel>(ioService) and hand it to the Scheduler.
+ *
+ * \note All the functions in this class are thread-safe
+ */
+class TimerWheel : public boost::asio::io_service::service, public TimerEngine{
+public:
+	static boost::asio::io_service::id id;
+
+	enum{
+		FirstLevelBits = 8,
+		LevelBits = 6,
+		Levels = 5,
+		FirstLevelSize = 1 << FirstLevelBits,
+		LevelSize = 1 << LevelBits
+	};
+
+	explicit TimerWheel(boost::asio::io_service& ioService);
+
+	void shutdown_service() override;
+
+	uint64_t now() override;
+
+	void add(Entry& entry, Handler&& handler) override;
+
+	bool remove(Entry& entry, Handler& handler) override;
+
+	/// Number of linked entries
+	std::size_t size();
+
+	/*! Runs the handlers already expired in the calling thread, returns how many were run
+	 * Used by the Dispatcher to run the due timers as a phase of its tick, instead of waiting
+	 * for the driver timer to post them.
+	 */
+	std::size_t poll();
+
+	/*! Disables (or enables back) the driver timer
+	 * While disabled the wheel never wakes up by itself, expired handlers only run from
+	 * poll(). The Dispatcher does this so timers run inside its tick, between the input and
+	 * the game phases.
+	 */
+	void setPolled(bool polled);
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	/// Places entry in the slot for its deadline relative to the current tick
+	void place(Entry& entry);
+
+	/// Moves the time forward up to tick, moving the expired handlers to fired
+	void advance(uint64_t tick, std::vector<Handler>& fired);
+
+	/// Re-places the entries of the due slot of the given level (and upper ones if needed)
+	void cascade(int level);
+
+	/// Returns the tick of the next expiration or cascade, only valid if count > 0
+	uint64_t nextWakeUp();
+
+	/// Arms the driver timer for tick if it isn't already armed for an earlier one, unless
+	/// the wheel is polled
+	void arm(uint64_t tick);
+
+	void onWakeUp(const SystemErrorCode& e);
+
+	/// Unlinks every entry moving its handler to handlers
+	void clear(std::vector<Handler>& handlers);
+
+	std::mutex mutex;
+	Clock::time_point start;
+	/// Last processed tick, every slot up to this one was already expired
+	uint64_t current {0};
+	std::size_t count {0};
+	bool armed {false};
+	bool polled {false};
+	uint64_t armedTick {0};
+	boost::asio::steady_timer driver;
+	std::array<Entry*, FirstLevelSize> firstLevel;
+	std::array<std::array<Entry*, LevelSize>, Levels-1> levels;
+};
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_TIMERWHEEL_H_
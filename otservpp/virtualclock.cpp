@@ -0,0 +1,145 @@
+#include "virtualclock.h"
+#include <limits>
+#include <algorithm>
+
+namespace otservpp {
+
+VirtualClock::VirtualClock(boost::asio::io_service& ioService, uint64_t start) :
+	TimerEngine(ioService),
+	current(start)
+{}
+
+VirtualClock::~VirtualClock()
+{
+	std::vector<Handler> handlers;
+	while(popNext(handlers, std::numeric_limits<uint64_t>::max()));
+	// destroying the handlers may destroy tasks, which remove() their entries
+	handlers.clear();
+}
+
+uint64_t VirtualClock::now()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return current;
+}
+
+void VirtualClock::add(Entry& entry, Handler&& handler)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	entry.handler = std::move(handler);
+	link(deadlines[entry.deadline], entry);
+	++count;
+}
+
+bool VirtualClock::remove(Entry& entry, Handler& handler)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if(!isLinked(entry))
+		return false;
+
+	unlink(entry);
+	auto it = deadlines.find(entry.deadline);
+	if(!it->second)
+		deadlines.erase(it);
+
+	--count;
+	handler = std::move(entry.handler);
+	return true;
+}
+
+std::size_t VirtualClock::size()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return count;
+}
+
+bool VirtualClock::advanceToNext()
+{
+	std::vector<Handler> handlers;
+	if(!popNext(handlers, std::numeric_limits<uint64_t>::max()))
+		return false;
+
+	postAll(handlers);
+	return true;
+}
+
+void VirtualClock::advance(uint64_t ms)
+{
+	auto target = now() + ms;
+
+	std::vector<Handler> handlers;
+	while(popNext(handlers, target)){
+		postAll(handlers);
+		handlers.clear();
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	current = std::max(current, target);
+}
+
+std::size_t VirtualClock::run()
+{
+	std::size_t handlers = 0;
+	do{
+		handlers += poll();
+	} while(advanceToNext());
+
+	return handlers;
+}
+
+std::size_t VirtualClock::runFor(uint64_t ms)
+{
+	auto target = now() + ms;
+	std::size_t run = 0;
+
+	std::vector<Handler> handlers;
+	for(;;){
+		run += poll();
+		if(!popNext(handlers, target))
+			break;
+
+		postAll(handlers);
+		handlers.clear();
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	current = std::max(current, target);
+	return run;
+}
+
+bool VirtualClock::popNext(std::vector<Handler>& handlers, uint64_t limit)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if(deadlines.empty() || deadlines.begin()->first > limit)
+		return false;
+
+	auto first = deadlines.begin();
+	current = std::max(current, first->first);
+
+	auto begin = handlers.size();
+	while(Entry* entry = first->second){
+		unlink(*entry);
+		--count;
+		handlers.push_back(std::move(entry->handler));
+	}
+	deadlines.erase(first);
+
+	// entries are linked at the front, keep the scheduling order
+	std::reverse(handlers.begin() + begin, handlers.end());
+	return true;
+}
+
+void VirtualClock::postAll(std::vector<Handler>& handlers)
+{
+	for(auto& handler : handlers)
+		post(std::move(handler), SystemErrorCode());
+}
+
+std::size_t VirtualClock::poll()
+{
+	auto run = ioService.poll();
+	ioService.reset();
+	return run;
+}
+
+} /* namespace otservpp */
@@ -0,0 +1,81 @@
+#ifndef OTSERVPP_VIRTUALCLOCK_H_
+#define OTSERVPP_VIRTUALCLOCK_H_
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include "timerengine.hpp"
+
+namespace otservpp {
+
+/*! Manually driven timer engine
+ * Time only moves when told to, jumping straight to the next deadline, so simulations, soak
+ * tests and replays of hours of game activity run as fast as the tasks themselves allow. The
+ * order of execution is deterministic: by deadline, then by scheduling order.
+ *
+ * Give it to a Scheduler (or to makeDeferredTask/makeIntervalTask) instead of the TimerWheel,
+ * the tasks don't notice the difference:
+ * 		VirtualClock clock(ioService);
+ * 		Scheduler scheduler(ioService, clock);
+ * 		scheduler.callEvery(1000, ...);
+ * 		clock.runFor(3600*1000); // an hour, in no time
+ *
+ * Handlers are posted to the io_service like any other engine does, run() and runFor() take
+ * care of polling it.
+ *
+ * \note All the functions in this class are thread-safe, but only one thread should be
+ * driving the clock
+ */
+class VirtualClock : public TimerEngine{
+public:
+	explicit VirtualClock(boost::asio::io_service& ioService, uint64_t start = 0);
+
+	~VirtualClock();
+
+	uint64_t now() override;
+
+	void add(Entry& entry, Handler&& handler) override;
+
+	bool remove(Entry& entry, Handler& handler) override;
+
+	/// Number of linked entries
+	std::size_t size();
+
+	/*! Jumps to the earliest deadline (if it isn't in the past) and posts every handler due
+	 * then, returns false if there are no pending timers
+	 */
+	bool advanceToNext();
+
+	/// Moves the time forward ms milliseconds, posting every handler due on the way
+	void advance(uint64_t ms);
+
+	/*! Polls the io_service jumping from deadline to deadline until there's nothing left to
+	 * do, returns the number of handlers run
+	 */
+	std::size_t run();
+
+	/// Same as run() but stops once the time would go past now()+ms
+	std::size_t runFor(uint64_t ms);
+
+private:
+	typedef std::map<uint64_t, Entry*> Deadlines;
+
+	/// Unlinks the entries of the earliest deadline, returns false if there are none
+	bool popNext(std::vector<Handler>& handlers, uint64_t limit);
+
+	/// Posts handlers in scheduling order
+	void postAll(std::vector<Handler>& handlers);
+
+	/// Runs the handlers ready in the io_service
+	std::size_t poll();
+
+	std::mutex mutex;
+	uint64_t current;
+	std::size_t count {0};
+	/// Each deadline keeps a list of the entries expiring then
+	Deadlines deadlines;
+};
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_VIRTUALCLOCK_H_
@@ -0,0 +1,140 @@
+#include "workstealingpool.h"
+#include <algorithm>
+#include <glog/logging.h>
+
+namespace otservpp {
+
+namespace{
+
+/// Pool and index of the worker running in this thread
+thread_local const WorkStealingPool* currentPool = nullptr;
+thread_local std::size_t currentIndex = 0;
+
+}
+
+WorkStealingPool::WorkStealingPool(std::size_t threads)
+{
+	if(threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	// every worker must exist before any of them tries to steal
+	for(std::size_t i = 0; i < threads; ++i){
+		workers.emplace_back(new Worker);
+		workers.back()->seed = (uint32_t)(i*2654435761u) | 1;
+	}
+
+	for(std::size_t i = 0; i < threads; ++i)
+		workers[i]->thread = std::thread([this, i]{ work(i); });
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+
+	wakeUp.notify_all();
+
+	for(auto& worker : workers){
+		if(worker->thread.joinable())
+			worker->thread.join();
+	}
+}
+
+void WorkStealingPool::post(Task task)
+{
+	Worker* target;
+	if(currentPool == this)
+		target = workers[currentIndex].get();
+	else
+		target = workers[nextWorker++ % workers.size()].get();
+
+	// counted before it's visible, so a worker never sees less pending tasks than queued ones
+	++pending;
+	{
+		std::lock_guard<std::mutex> lock(target->mutex);
+		target->tasks.push_back(std::move(task));
+	}
+
+	if(sleepers > 0){
+		// a worker going to sleep is either before checking pending or already waiting
+		{ std::lock_guard<std::mutex> lock(sleepMutex); }
+		wakeUp.notify_one();
+	}
+}
+
+bool WorkStealingPool::isWorkerThread() const
+{
+	return currentPool == this;
+}
+
+void WorkStealingPool::work(std::size_t index)
+{
+	currentPool = this;
+	currentIndex = index;
+	Worker& self = *workers[index];
+
+	Task task;
+	for(;;){
+		if(stopping)
+			return;
+
+		if(popLocal(self, task) || steal(self, task)){
+			try{
+				task();
+			} catch(std::exception& e){
+				LOG(ERROR) << "Uncaught exception in parallel task: " << e.what();
+			}
+			task = nullptr;
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		++sleepers;
+		wakeUp.wait(lock, [this]{ return stopping || pending > 0; });
+		--sleepers;
+	}
+}
+
+bool WorkStealingPool::popLocal(Worker& self, Task& task)
+{
+	std::lock_guard<std::mutex> lock(self.mutex);
+	if(self.tasks.empty())
+		return false;
+
+	task = std::move(self.tasks.back());
+	self.tasks.pop_back();
+	--pending;
+	return true;
+}
+
+bool WorkStealingPool::steal(Worker& self, Task& task)
+{
+	auto size = workers.size();
+	if(size < 2)
+		return false;
+
+	self.seed ^= self.seed << 13;
+	self.seed ^= self.seed >> 17;
+	self.seed ^= self.seed << 5;
+
+	for(std::size_t i = 0, first = self.seed % size; i < size; ++i){
+		Worker& victim = *workers[(first+i) % size];
+		if(&victim == &self)
+			continue;
+
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if(victim.tasks.empty())
+			continue;
+
+		task = std::move(victim.tasks.front());
+		victim.tasks.pop_front();
+		--pending;
+		return true;
+	}
+
+	return false;
+}
+
+} /* namespace otservpp */
@@ -0,0 +1,87 @@
+#ifndef OTSERVPP_WORKSTEALINGPOOL_H_
+#define OTSERVPP_WORKSTEALINGPOOL_H_
+
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+namespace otservpp {
+
+/*! Work-stealing thread pool
+ * Every worker has its own deque of tasks. Tasks posted from a worker thread go to its deque
+ * and are run LIFO, so nested fan-outs (e.g. pathfinding spawning subtasks) stay in the same
+ * core's cache. Tasks posted from any other thread are spread round-robin between the workers.
+ * An idle worker steals the oldest task of a random victim before going to sleep.
+ *
+ * Each deque has its own lock, which is only contended when a worker is being robbed, so
+ * there's no global queue serializing every post.
+ *
+ * \note All the functions in this class are thread-safe
+ */
+class WorkStealingPool{
+public:
+	typedef std::function<void()> Task;
+
+	/// Starts the given number of workers, one per core if 0
+	explicit WorkStealingPool(std::size_t threads = 0);
+
+	/// Stops the workers, tasks not yet started are discarded
+	~WorkStealingPool();
+
+	/// Queues task to be run by a worker
+	void post(Task task);
+
+	/// Number of worker threads
+	std::size_t size() const
+	{
+		return workers.size();
+	}
+
+	/// Number of tasks queued and not yet taken by a worker
+	std::size_t queued() const
+	{
+		return pending.load(std::memory_order_relaxed);
+	}
+
+	/// Returns true if the calling thread is one of the workers of this pool
+	bool isWorkerThread() const;
+
+	WorkStealingPool(WorkStealingPool&) = delete;
+	void operator=(WorkStealingPool&) = delete;
+
+private:
+	struct Worker{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+		std::thread thread;
+		/// xorshift state for picking victims
+		uint32_t seed;
+	};
+
+	void work(std::size_t index);
+
+	/// Takes the newest task of self
+	bool popLocal(Worker& self, Task& task);
+
+	/// Takes the oldest task of any other worker, starting by a random one
+	bool steal(Worker& self, Task& task);
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::atomic<std::size_t> nextWorker {0};
+	/// Tasks queued and not yet taken by a worker
+	std::atomic<std::size_t> pending {0};
+
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+	std::atomic<std::size_t> sleepers {0};
+	std::atomic<bool> stopping {false};
+};
+
+} /* namespace otservpp */
+
+#endif // OTSERVPP_WORKSTEALINGPOOL_H_
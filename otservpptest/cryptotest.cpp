@@ -0,0 +1,372 @@
+// same OpenSSL API level as otservpp/crypto.cpp
+#define OPENSSL_API_COMPAT 0x10101000L
+#include <gtest/gtest.h>
+#include <chrono>
+#include <random>
+#include <future>
+#include <atomic>
+#include <vector>
+#include <cstdio>
+#include <openssl/rsa.h>
+#include <openssl/bn.h>
+#include <openssl/pem.h>
+#include "otservpp/crypto.h"
+
+namespace crypto = otservpp::crypto;
+namespace detail = otservpp::crypto::detail;
+
+namespace{
+	typedef uint32_t (*Adler32Function)(uint32_t, const uint8_t*, std::size_t);
+
+	std::vector<Adler32Function> adler32Variants()
+	{
+		std::vector<Adler32Function> variants{detail::adler32Scalar};
+#ifdef OTSERVPP_CRYPTO_X86_SIMD
+		if(detail::hasSsse3())
+			variants.push_back(detail::adler32Ssse3);
+		if(detail::hasAvx2())
+			variants.push_back(detail::adler32Avx2);
+#endif
+		return variants;
+	}
+
+	std::vector<uint8_t> randomBytes(std::size_t size, std::mt19937& rng)
+	{
+		std::vector<uint8_t> bytes(size);
+		for(auto& byte : bytes)
+			byte = (uint8_t)rng();
+		return bytes;
+	}
+
+	struct XteaVariant{
+		const char* name;
+		void (*encrypt)(const uint32_t*, uint32_t*, std::size_t);
+		void (*decrypt)(const uint32_t*, uint32_t*, std::size_t);
+	};
+
+	std::vector<XteaVariant> xteaVariants()
+	{
+		std::vector<XteaVariant> variants{
+			{"scalar", detail::xteaEncryptScalar, detail::xteaDecryptScalar}};
+#ifdef OTSERVPP_CRYPTO_X86_SIMD
+		if(detail::hasSse2())
+			variants.push_back({"sse2", detail::xteaEncryptSse2, detail::xteaDecryptSse2});
+		if(detail::hasAvx2())
+			variants.push_back({"avx2", detail::xteaEncryptAvx2, detail::xteaDecryptAvx2});
+#endif
+		return variants;
+	}
+
+
+	std::string toDec(const BIGNUM* bn)
+	{
+		char* dec = BN_bn2dec(bn);
+		std::string str(dec);
+		OPENSSL_free(dec);
+		return str;
+	}
+
+	/// A fresh 1024 bits key (the size used by the login protocols)
+	struct TestRsaKey{
+		TestRsaKey() :
+			rsa(RSA_new())
+		{
+			BIGNUM* e = BN_new();
+			BN_set_word(e, RSA_F4);
+			RSA_generate_key_ex(rsa, 1024, e, nullptr);
+			BN_free(e);
+
+			const BIGNUM *bn, *be, *bd, *bp, *bq;
+			RSA_get0_key(rsa, &bn, &be, &bd);
+			RSA_get0_factors(rsa, &bp, &bq);
+			n = toDec(bn); e_ = toDec(be); d = toDec(bd); p = toDec(bp); q = toDec(bq);
+		}
+
+		~TestRsaKey()
+		{
+			RSA_free(rsa);
+		}
+
+		/// Returns a random block encrypted with the public key, plain receives the block
+		std::vector<uint8_t> encryptRandomBlock(std::vector<uint8_t>& plain, std::mt19937& rng)
+		{
+			plain = randomBytes(128, rng);
+			plain[0] = 0; // keeps it smaller than n
+			std::vector<uint8_t> cipher(128);
+			RSA_public_encrypt(128, plain.data(), cipher.data(), rsa, RSA_NO_PADDING);
+			return cipher;
+		}
+
+		RSA* rsa;
+		std::string n, e_, d, p, q;
+	};
+
+	/// Decrypts buffer with rsa synchronously
+	int decryptBlock(crypto::Rsa& rsa, boost::asio::io_service& io, uint8_t* buffer)
+	{
+		int decryptedLen = -1;
+		rsa.decrypt(buffer, 128, [&](boost::system::error_condition& e, int len){
+			decryptedLen = e? -1 : len;
+		});
+		io.run();
+		io.reset();
+		return decryptedLen;
+	}
+
+	// packet sizes from tiny to STANDARD_OUT_MESSAGE_MAX_SIZE
+	const std::size_t packetSizes[] = {16, 64, 256, 1024, 4096, 16384, 20000};
+}
+
+TEST(Adler32Test, MatchesKnownValue){
+	uint8_t data[] = {'W', 'i', 'k', 'i', 'p', 'e', 'd', 'i', 'a'};
+	ASSERT_EQ(0x11E60398u, crypto::adler32(data, sizeof(data)));
+}
+
+TEST(Adler32Test, VariantsAreBitIdenticalForRandomData){
+	std::mt19937 rng(1234);
+
+	for(std::size_t size = 1; size < 20000; size += 1 + size/8){
+		auto bytes = randomBytes(size, rng);
+		auto expected = detail::adler32Scalar(1, bytes.data(), size);
+
+		ASSERT_EQ(expected, crypto::adler32(bytes.data(), (int32_t)size)) << "size " << size;
+		for(auto adler32 : adler32Variants())
+			ASSERT_EQ(expected, adler32(1, bytes.data(), size)) << "size " << size;
+	}
+}
+
+TEST(Adler32Test, ContinuesChecksumInChunks){
+	std::mt19937 rng(1234);
+	auto bytes = randomBytes(5000, rng);
+	auto expected = detail::adler32Scalar(1, bytes.data(), bytes.size());
+
+	uint32_t adler = 1;
+	for(std::size_t pos = 0; pos < bytes.size(); pos += 333){
+		auto chunk = std::min<std::size_t>(333, bytes.size() - pos);
+		adler = crypto::adler32(adler, bytes.data() + pos, chunk);
+	}
+
+	ASSERT_EQ(expected, adler);
+}
+
+TEST(Adler32Test, VariantsAreBitIdenticalForWorstCaseSums){
+	// all 0xff maximizes the partial sums, checking the NMAX chunking doesn't overflow
+	for(std::size_t size : {31u, 32u, 33u, 5536u, 5552u, 5553u, 11104u, 20000u, 65536u}){
+		std::vector<uint8_t> bytes(size, 0xff);
+		auto expected = detail::adler32Scalar(1, bytes.data(), size);
+
+		for(auto adler32 : adler32Variants())
+			ASSERT_EQ(expected, adler32(1, bytes.data(), size)) << "size " << size;
+	}
+}
+
+TEST(XteaTest, MatchesKnownVector){
+	crypto::Xtea xtea(0x00010203, 0x04050607, 0x08090a0b, 0x0c0d0e0f);
+	uint32_t block[2] = {0x41424344, 0x45464748};
+
+	xtea.encrypt(block, sizeof(block));
+	ASSERT_EQ(0x497df3d0u, block[0]);
+	ASSERT_EQ(0x72612cb5u, block[1]);
+
+	xtea.decrypt(block, sizeof(block));
+	ASSERT_EQ(0x41424344u, block[0]);
+	ASSERT_EQ(0x45464748u, block[1]);
+}
+
+TEST(XteaTest, VariantsAreBitIdentical){
+	std::mt19937 rng(1234);
+	const uint32_t key[4] = {(uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng()};
+
+	// odd block counts exercise the scalar leftovers of the SIMD versions
+	for(std::size_t blocks = 1; blocks < 2600; blocks += 1 + blocks/4){
+		std::vector<uint32_t> plain(blocks*2);
+		for(auto& word : plain)
+			word = rng();
+
+		auto expected = plain;
+		detail::xteaEncryptScalar(key, expected.data(), blocks*8);
+
+		for(auto& variant : xteaVariants()){
+			auto data = plain;
+			variant.encrypt(key, data.data(), blocks*8);
+			ASSERT_EQ(expected, data) << variant.name << " " << blocks << " blocks";
+
+			variant.decrypt(key, data.data(), blocks*8);
+			ASSERT_EQ(plain, data) << variant.name << " " << blocks << " blocks";
+		}
+	}
+}
+
+TEST(XteaTest, DISABLED_Benchmark){
+	std::mt19937 rng(1234);
+	const uint32_t key[4] = {(uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng()};
+
+	for(auto size : packetSizes){
+		std::vector<uint32_t> data(size/4);
+		std::size_t iterations = 20000000/size;
+
+		for(auto& variant : xteaVariants()){
+			auto start = std::chrono::steady_clock::now();
+			for(std::size_t i = 0; i != iterations; ++i)
+				variant.encrypt(key, data.data(), size);
+			std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+
+			std::cout << "xtea " << variant.name << " " << size << " B: "
+					<< (double)(size*iterations)/secs.count()/1e6 << " MB/s" << std::endl;
+		}
+	}
+}
+
+TEST(Adler32Test, DISABLED_Benchmark){
+	std::mt19937 rng(1234);
+	const char* names[] = {"scalar", "ssse3", "avx2"};
+	auto variants = adler32Variants();
+
+	for(auto size : packetSizes){
+		auto bytes = randomBytes(size, rng);
+		std::size_t iterations = 200000000/size;
+
+		for(std::size_t v = 0; v != variants.size(); ++v){
+			uint32_t sink = 0;
+			auto start = std::chrono::steady_clock::now();
+			for(std::size_t i = 0; i != iterations; ++i)
+				sink += variants[v](1, bytes.data(), size);
+			std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+
+			std::cout << "adler32 " << names[v] << " " << size << " B: "
+					<< (double)(size*iterations)/secs.count()/1e6 << " MB/s"
+					<< (sink == 42? " " : "") << std::endl;
+		}
+	}
+}
+
+TEST(RsaTest, DecryptsWithDerivedCrtParameters){
+	std::mt19937 rng(1234);
+	TestRsaKey key;
+	boost::asio::io_service io;
+	crypto::Rsa rsa(io, key.n.c_str(), key.e_.c_str(), key.d.c_str(), key.p.c_str(),
+			key.q.c_str());
+
+	std::vector<uint8_t> plain;
+	auto cipher = key.encryptRandomBlock(plain, rng);
+
+	ASSERT_EQ(128, decryptBlock(rsa, io, cipher.data()));
+	ASSERT_EQ(plain, cipher);
+}
+
+TEST(RsaTest, RejectsInconsistentKeys){
+	TestRsaKey key, other;
+	boost::asio::io_service io;
+	ASSERT_THROW(crypto::Rsa(io, key.n.c_str(), key.e_.c_str(), key.d.c_str(),
+			other.p.c_str(), other.q.c_str()), boost::system::system_error);
+}
+
+TEST(RsaTest, LoadsPemKey){
+	std::mt19937 rng(1234);
+	TestRsaKey key;
+	boost::asio::io_service io;
+
+	std::string path = testing::TempDir() + "otservpp_rsa_test.pem";
+	FILE* file = fopen(path.c_str(), "w");
+	ASSERT_NE(nullptr, file);
+	PEM_write_RSAPrivateKey(file, key.rsa, nullptr, nullptr, 0, nullptr, nullptr);
+	fclose(file);
+
+	crypto::Rsa rsa(io, path);
+	std::remove(path.c_str());
+
+	std::vector<uint8_t> plain;
+	auto cipher = key.encryptRandomBlock(plain, rng);
+
+	ASSERT_EQ(128, decryptBlock(rsa, io, cipher.data()));
+	ASSERT_EQ(plain, cipher);
+	ASSERT_THROW(crypto::Rsa(io, path), boost::system::system_error);
+}
+
+TEST(RsaTest, DecryptsConcurrentlyFromManyConnections){
+	enum{ Blocks = 64 };
+	std::mt19937 rng(1234);
+	TestRsaKey key;
+	boost::asio::io_service io;
+	crypto::Rsa rsa(io, key.n.c_str(), key.e_.c_str(), key.d.c_str(), key.p.c_str(),
+			key.q.c_str());
+
+	std::vector<std::vector<uint8_t>> plains(Blocks), ciphers;
+	for(auto& plain : plains)
+		ciphers.push_back(key.encryptRandomBlock(plain, rng));
+
+	int done = 0;
+	for(auto& cipher : ciphers){
+		rsa.decrypt(cipher.data(), 128, [&](boost::system::error_condition& e, int len){
+			ASSERT_FALSE(e);
+			ASSERT_EQ(128, len);
+			++done;
+		});
+	}
+	io.run();
+
+	ASSERT_EQ(Blocks, done);
+	ASSERT_EQ(plains, ciphers);
+
+	auto stats = boost::asio::use_service<crypto::CryptoService>(io).getStats();
+	ASSERT_EQ(0u, stats.queueDepth);
+	ASSERT_EQ((uint64_t)Blocks, stats.completed);
+	ASSERT_LE(stats.averageLatency, stats.maxLatency);
+}
+
+TEST(CryptoServiceTest, RejectsJobsWhenTheQueueIsFull){
+	boost::asio::io_service io;
+	auto& svc = boost::asio::use_service<crypto::CryptoService>(io);
+
+	std::promise<void> release;
+	std::shared_future<void> released(release.get_future());
+
+	// keeps every worker busy so the queue fills up
+	std::atomic<std::size_t> busy {0};
+	for(std::size_t i = 0; i < svc.size(); ++i)
+		ASSERT_TRUE(svc.post([&, released]{ ++busy; released.wait(); }));
+	while(busy != svc.size())
+		std::this_thread::yield();
+
+	std::atomic<int> runs {0};
+	for(int i = 0; i != crypto::CryptoService::MaxQueuedJobs; ++i)
+		ASSERT_TRUE(svc.post([&]{ ++runs; }));
+
+	ASSERT_FALSE(svc.post([&]{ ++runs; }));
+	ASSERT_EQ((std::size_t)crypto::CryptoService::MaxQueuedJobs, svc.getStats().queueDepth);
+	ASSERT_EQ(1u, svc.getStats().rejected);
+
+	release.set_value();
+	io.run();
+	ASSERT_EQ(crypto::CryptoService::MaxQueuedJobs, runs.load());
+}
+
+TEST(RsaTest, DISABLED_Benchmark){
+	enum{ Iterations = 2000 };
+	std::mt19937 rng(1234);
+	TestRsaKey key;
+	std::vector<uint8_t> plain;
+	auto cipher = key.encryptRandomBlock(plain, rng);
+
+	// the way keys were loaded before: n, e and d only, no CRT
+	RSA* plainRsa = RSA_new();
+	const BIGNUM *n, *e, *d;
+	RSA_get0_key(key.rsa, &n, &e, &d);
+	RSA_set0_key(plainRsa, BN_dup(n), BN_dup(e), BN_dup(d));
+
+	// both keys are timed straight through RSA_private_decrypt, no CryptoService round trips
+	auto run = [&](RSA* rsa, const char* name){
+		auto start = std::chrono::steady_clock::now();
+		for(int i = 0; i != Iterations; ++i){
+			auto buffer = cipher;
+			ASSERT_EQ(128, RSA_private_decrypt(128, buffer.data(), buffer.data(), rsa,
+					RSA_NO_PADDING));
+		}
+		std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+		std::cout << name << ": " << Iterations/secs.count() << " decrypts/s" << std::endl;
+	};
+
+	run(plainRsa, "rsa without crt");
+	run(key.rsa, "rsa with crt");
+	RSA_free(plainRsa);
+}
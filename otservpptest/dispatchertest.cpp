@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <boost/asio.hpp>
+#include "otservpp/dispatcher.h"
+#include "otservpp/scheduler.hpp"
+#include "otservpp/timerwheel.h"
+#include "otservpp/protocol/gameinbox.h"
+#include "otservpp/protocol/tickflushlist.h"
+
+using otservpp::Dispatcher;
+using otservpp::Scheduler;
+using otservpp::TimerWheel;
+using otservpp::GameInbox;
+using otservpp::TickFlushList;
+
+namespace{
+	void sleepMs(int ms)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+	}
+}
+
+/// Ticks are long enough for tests calling tick() by hand to never overrun one
+class DispatcherTest : public ::testing::Test{
+protected:
+	explicit DispatcherTest(int tickLength = 1000) :
+		dispatcher(ioService, tickLength)
+	{}
+
+	Dispatcher::PhaseStats phaseStats(const std::string& name)
+	{
+		for(auto& phase : dispatcher.getStats().phases){
+			if(phase.name == name)
+				return phase;
+		}
+		ADD_FAILURE() << "no phase " << name;
+		return {};
+	}
+
+	boost::asio::io_service ioService;
+	Dispatcher dispatcher;
+};
+
+/// Ticks a phase can overrun by sleeping a bit
+class ShortTickDispatcherTest : public DispatcherTest{
+protected:
+	ShortTickDispatcherTest() : DispatcherTest(10){}
+};
+
+/// Ticks long enough for the timing of a started dispatcher to be checked on a busy machine
+class RunningDispatcherTest : public DispatcherTest{
+protected:
+	RunningDispatcherTest() : DispatcherTest(TickLength){}
+
+	static const int TickLength = 50;
+};
+
+TEST_F(DispatcherTest, RunsPhasesInOrder){
+	std::vector<std::string> order;
+	Scheduler scheduler(ioService, boost::asio::use_service<TimerWheel>(ioService));
+
+	GameInbox::instance().post([&]{ order.push_back("input"); });
+	scheduler.callAfter(0, [&]{ order.push_back("timers"); });
+	dispatcher.addPhase("first", Dispatcher::Normal, [&]{ order.push_back("first"); });
+	dispatcher.addPhase("second", Dispatcher::Low, [&]{ order.push_back("second"); });
+	TickFlushList::instance().add([&]{ order.push_back("output"); });
+
+	sleepMs(2);
+	dispatcher.tick();
+	ASSERT_EQ((std::vector<std::string>{"input", "timers", "first", "second", "output"}), order);
+
+	auto stats = dispatcher.getStats();
+	ASSERT_EQ(1u, stats.ticks);
+	ASSERT_EQ(5u, stats.phases.size());
+	ASSERT_EQ("output", stats.phases.back().name);
+}
+
+TEST_F(ShortTickDispatcherTest, SkipsLowPriorityPhasesOnOverrun){
+	int normalRuns = 0, lowRuns = 0;
+	dispatcher.addPhase("slow", Dispatcher::Normal, [&]{ ++normalRuns; sleepMs(15); });
+	dispatcher.addPhase("normal", Dispatcher::Normal, [&]{ ++normalRuns; });
+	dispatcher.addPhase("low", Dispatcher::Low, [&]{ ++lowRuns; });
+
+	dispatcher.tick();
+	ASSERT_EQ(1, normalRuns);
+	ASSERT_EQ(0, lowRuns);
+	ASSERT_EQ(1u, phaseStats("normal").skipped);
+	ASSERT_EQ(1u, phaseStats("low").skipped);
+	ASSERT_EQ(1u, dispatcher.getStats().overruns);
+	ASSERT_GE(phaseStats("slow").lastTime, 15000u);
+}
+
+TEST_F(ShortTickDispatcherTest, NeverStarvesAPhase){
+	int lowRuns = 0;
+	dispatcher.addPhase("slow", Dispatcher::Normal, []{ sleepMs(11); });
+	dispatcher.addPhase("low", Dispatcher::Low, [&]{ ++lowRuns; });
+
+	for(int i = 0; i < Dispatcher::MaxConsecutiveSkips; ++i)
+		dispatcher.tick();
+	ASSERT_EQ(0, lowRuns);
+
+	dispatcher.tick();
+	ASSERT_EQ(1, lowRuns);
+}
+
+TEST_F(RunningDispatcherTest, TicksAtAFixedRate){
+	const int expectedTicks = 8, busyTime = 4*TickLength/5;
+	int ticks = 0;
+	dispatcher.addPhase("count", Dispatcher::Normal, [&]{
+		if(++ticks == expectedTicks)
+			return dispatcher.stop();
+		// the time spent in a tick doesn't delay the next one
+		sleepMs(busyTime);
+	});
+
+	auto begin = std::chrono::steady_clock::now();
+	dispatcher.start();
+	ioService.run();
+	auto elapsed = std::chrono::steady_clock::now() - begin;
+
+	ASSERT_EQ(expectedTicks, ticks);
+	ASSERT_GE(elapsed, std::chrono::milliseconds(expectedTicks*TickLength));
+	// scheduling each tick after the previous one finished would take
+	// expectedTicks*TickLength + (expectedTicks-1)*busyTime, the bound is halfway there
+	ASSERT_LT(elapsed, std::chrono::milliseconds(expectedTicks*TickLength +
+			(expectedTicks-1)*busyTime/2));
+}
+
+TEST_F(RunningDispatcherTest, CountsMissedTicksInsteadOfBursting){
+	int ticks = 0;
+	dispatcher.addPhase("count", Dispatcher::Normal, [&]{
+		if(++ticks == 1)
+			sleepMs(7*TickLength/2);
+		else
+			dispatcher.stop();
+	});
+
+	dispatcher.start();
+	ioService.run();
+
+	// the ticks due 1 and 2 periods after the slow one are lost (more if the machine is busy),
+	// the one due 3 periods after it runs late
+	ASSERT_EQ(2, ticks);
+	ASSERT_GE(dispatcher.getStats().missedTicks, 2u);
+}
+
+TEST_F(DispatcherTest, RunsTimersOnlyInsideTheTick){
+	Scheduler scheduler(ioService, boost::asio::use_service<TimerWheel>(ioService));
+	int runs = 0;
+	scheduler.callAfter(1, [&]{ ++runs; });
+	dispatcher.start();
+
+	// the timer is due, but the wheel doesn't post it to the io_service by itself
+	sleepMs(5);
+	ioService.poll();
+	ASSERT_EQ(0, runs);
+
+	dispatcher.tick();
+	ASSERT_EQ(1, runs);
+	ASSERT_EQ(1u, phaseStats("timers").runs);
+	dispatcher.stop();
+}
+
+TEST_F(DispatcherTest, LeavesTimersToTheIoServiceWhileStopped){
+	Scheduler scheduler(ioService, boost::asio::use_service<TimerWheel>(ioService));
+	int runs = 0;
+
+	// before start()
+	scheduler.callAfter(1, [&]{ ++runs; });
+	ioService.run();
+	ASSERT_EQ(1, runs);
+
+	// and after stop()
+	dispatcher.start();
+	dispatcher.stop();
+	scheduler.callAfter(1, [&]{ ++runs; });
+	ioService.reset();
+	ioService.run();
+	ASSERT_EQ(2, runs);
+	ASSERT_EQ(0u, dispatcher.getStats().ticks);
+}
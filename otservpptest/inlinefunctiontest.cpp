@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include "otservpp/inlinefunction.hpp"
+
+using otservpp::InlineFunction;
+
+namespace{
+	struct Big{
+		int operator()(int x){ return x + payload[0]; }
+		char payload[100] = {1};
+	};
+}
+
+TEST(InlineFunctionTest, StoresSmallCallablesInline){
+	int* p = nullptr;
+	int n = 0;
+	auto small = [p, n](int x){ return x + n + (p? 1 : 0); };
+	ASSERT_TRUE(InlineFunction<int(int)>::isInline<decltype(small)>());
+	ASSERT_FALSE(InlineFunction<int(int)>::isInline<Big>());
+
+	InlineFunction<int(int)> f(small);
+	ASSERT_EQ(3, f(3));
+}
+
+TEST(InlineFunctionTest, StoresBigCallablesInTheHeap){
+	InlineFunction<int(int)> f {Big()};
+	ASSERT_EQ(4, f(3));
+
+	InlineFunction<int(int)> g(std::move(f));
+	ASSERT_FALSE(f);
+	ASSERT_EQ(5, g(4));
+}
+
+TEST(InlineFunctionTest, HoldsMoveOnlyCallables){
+	std::unique_ptr<int> value(new int(7));
+	auto owner = std::make_shared<int>(0);
+	struct MoveOnly{
+		int operator()(){ return *value; }
+		std::unique_ptr<int> value;
+		std::shared_ptr<int> owner;
+	};
+
+	InlineFunction<int()> f {MoveOnly{std::move(value), owner}};
+	ASSERT_EQ(2, owner.use_count());
+
+	InlineFunction<int()> g;
+	g = std::move(f);
+	ASSERT_EQ(7, g());
+
+	g = nullptr;
+	ASSERT_FALSE(g);
+	ASSERT_EQ(1, owner.use_count());
+}
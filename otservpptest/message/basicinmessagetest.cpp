@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+#include <boost/asio/buffer.hpp>
+#include "otservpp/message/basicinmessage.hpp"
+
+using otservpp::BasicInMessage;
+using boost::asio::buffer_size;
+using boost::asio::buffer_cast;
+
+namespace{
+	struct TestMessage : public BasicInMessage<2, 1000, 16>{
+		// makes the next `bytes` bytes readable, as a parsed header would
+		void setBody(unsigned int bytes)
+		{
+			skipBytes(2);
+			setRemainingSize(bytes);
+		}
+
+		uint8_t* getData()
+		{
+			return buffer_cast<uint8_t*>(getHeaderBuffer());
+		}
+	};
+}
+
+TEST(BasicInMessageTest, UsesInlineBufferForSmallMessages){
+	TestMessage msg;
+	auto inlineData = msg.getData();
+	msg.setBody(14);
+	ASSERT_EQ(inlineData, msg.getData());
+	ASSERT_EQ(14u, buffer_size(msg.getBodyBuffer()));
+}
+
+TEST(BasicInMessageTest, BorrowsBufferForBigMessagesKeepingTheHeader){
+	TestMessage msg;
+	auto inlineData = msg.getData();
+	inlineData[0] = 0x12;
+	inlineData[1] = 0x34;
+	msg.setBody(500);
+
+	ASSERT_NE(inlineData, msg.getData());
+	ASSERT_EQ(0x12, msg.getData()[0]);
+	ASSERT_EQ(0x34, msg.getData()[1]);
+	ASSERT_EQ(500u, buffer_size(msg.getBodyBuffer()));
+}
+
+TEST(BasicInMessageTest, GoesBackToInlineBufferOnReset){
+	TestMessage msg;
+	auto inlineData = msg.getData();
+	msg.setBody(500);
+	msg.reset();
+	ASSERT_EQ(inlineData, msg.getData());
+	ASSERT_EQ(2u, msg.getSize());
+}
+
+TEST(BasicInMessageTest, MovesBorrowedBuffer){
+	TestMessage msg;
+	msg.setBody(500);
+	auto data = msg.getData();
+
+	TestMessage other(std::move(msg));
+	ASSERT_EQ(data, other.getData());
+	ASSERT_EQ(502u, other.getSize());
+}
+
+TEST(BasicInMessageTest, MovesInlineContents){
+	TestMessage msg;
+	msg.getData()[0] = 0x12;
+	msg.getData()[1] = 0x34;
+	msg.setBody(4);
+	msg.getData()[5] = 0x56;
+
+	TestMessage other(std::move(msg));
+	ASSERT_NE(msg.getData(), other.getData());
+	ASSERT_EQ(6u, other.getSize());
+	ASSERT_EQ(0x12, other.getData()[0]);
+	ASSERT_EQ(0x34, other.getData()[1]);
+	ASSERT_EQ(0x56, other.getData()[5]);
+}
@@ -119,3 +119,47 @@ TYPED_TEST(BasicOutMessageTest, AddsDataAfterPrefixes){
 	ASSERT_EQ(this->value, *(this->getBuffer()+1));
 	ASSERT_EQ(value3, *(this->getBuffer()+2));
 }
+
+namespace{
+	struct FlaggedMessage : public BasicOutMessage<FlaggedMessage, 100, 10000>{
+		FlaggedMessage(bool droppable, uint32_t key) :
+			BasicOutMessage<FlaggedMessage, 100, 10000>(100)
+		{
+			addByte(1);
+			setDroppable(droppable);
+			setSupersedeKey(key);
+		}
+
+		FlaggedMessage() : BasicOutMessage<FlaggedMessage, 100, 10000>(100){}
+	};
+}
+
+TEST(BasicOutMessageFlagsTest, AggregateTakesTheFlagsOfItsFirstPart){
+	FlaggedMessage aggregate;
+	aggregate.addMessage(FlaggedMessage(true, 7));
+
+	ASSERT_TRUE(aggregate.isDroppable());
+	ASSERT_EQ(7u, aggregate.getSupersedeKey());
+}
+
+TEST(BasicOutMessageFlagsTest, AggregateIsDroppableOnlyIfEveryPartIs){
+	FlaggedMessage aggregate;
+	aggregate.addMessage(FlaggedMessage(true, 0));
+	aggregate.addMessage(FlaggedMessage(true, 0));
+	ASSERT_TRUE(aggregate.isDroppable());
+
+	aggregate.addMessage(FlaggedMessage(false, 0));
+	aggregate.addMessage(FlaggedMessage(true, 0));
+	ASSERT_FALSE(aggregate.isDroppable());
+}
+
+TEST(BasicOutMessageFlagsTest, AggregateKeepsOnlyASharedSupersedeKey){
+	FlaggedMessage aggregate;
+	aggregate.addMessage(FlaggedMessage(false, 7));
+	aggregate.addMessage(FlaggedMessage(false, 7));
+	ASSERT_EQ(7u, aggregate.getSupersedeKey());
+
+	aggregate.addMessage(FlaggedMessage(false, 8));
+	aggregate.addMessage(FlaggedMessage(false, 7));
+	ASSERT_EQ(0u, aggregate.getSupersedeKey());
+}
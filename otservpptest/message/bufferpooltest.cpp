@@ -0,0 +1,44 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <algorithm>
+#include <vector>
+#include "otservpp/message/bufferpool.h"
+
+using otservpp::BufferPool;
+
+TEST(BufferPoolTest, RoundsToSizeClasses){
+	ASSERT_EQ(256u, BufferPool::roundSize(1));
+	ASSERT_EQ(1024u, BufferPool::roundSize(1024));
+	ASSERT_EQ(4096u, BufferPool::roundSize(1025));
+	ASSERT_EQ(100000u, BufferPool::roundSize(100000));
+}
+
+TEST(BufferPoolTest, RecyclesBuffersOfTheSameClass){
+	auto& pool = BufferPool::instance();
+	auto buffer = pool.allocate(1000);
+	pool.deallocate(buffer, 1000);
+	ASSERT_EQ(buffer, pool.allocate(1024));
+	pool.deallocate(buffer, 1024);
+}
+
+TEST(BufferPoolTest, ReusesBuffersReleasedByOtherThreads){
+	auto& pool = BufferPool::instance();
+	std::vector<uint8_t*> buffers;
+
+	std::thread([&]{
+		for(int i = 0; i != BufferPool::MaxThreadFreeBuffers + 1; ++i)
+			buffers.push_back(pool.allocate(16384));
+	}).join();
+
+	// released here, the last one overflows this thread cache into the shared list
+	for(auto buffer : buffers)
+		pool.deallocate(buffer, 16384);
+
+	uint8_t* reused = nullptr;
+	std::thread([&]{
+		reused = pool.allocate(16384);
+		pool.deallocate(reused, 16384);
+	}).join();
+
+	ASSERT_NE(buffers.end(), std::find(buffers.begin(), buffers.end(), reused));
+}
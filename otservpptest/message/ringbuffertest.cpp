@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+#include <numeric>
+#include <vector>
+#include "otservpp/message/ringbuffer.hpp"
+
+using otservpp::RingBuffer;
+using boost::asio::buffer;
+using boost::asio::buffer_size;
+using boost::asio::buffer_cast;
+
+namespace{
+	typedef RingBuffer<16> TestBuffer;
+
+	// writes count bytes starting at value into the free space of rb
+	void write(TestBuffer& rb, std::size_t count, uint8_t value)
+	{
+		auto free = rb.prepare();
+		ASSERT_GE(buffer_size(free[0]) + buffer_size(free[1]), count);
+
+		for(auto& b : free){
+			auto size = std::min(count, buffer_size(b));
+			std::iota(buffer_cast<uint8_t*>(b), buffer_cast<uint8_t*>(b)+size, value);
+			value += size;
+			count -= size;
+			rb.commit(size);
+		}
+	}
+}
+
+TEST(RingBufferTest, IsEmptyOnStart){
+	TestBuffer rb;
+	ASSERT_TRUE(rb.empty());
+	ASSERT_EQ(0u, rb.size());
+	ASSERT_EQ(16u, rb.available());
+}
+
+TEST(RingBufferTest, ExposesWholeSpaceAsOneBufferWhenEmpty){
+	TestBuffer rb;
+	write(rb, 10, 0);
+	std::vector<uint8_t> out(10);
+	rb.read(buffer(out));
+
+	auto free = rb.prepare();
+	ASSERT_EQ(16u, buffer_size(free[0]));
+	ASSERT_EQ(0u, buffer_size(free[1]));
+}
+
+TEST(RingBufferTest, ReadsBackWrittenData){
+	TestBuffer rb;
+	write(rb, 12, 7);
+
+	std::vector<uint8_t> out(12);
+	rb.read(buffer(out));
+
+	for(unsigned i = 0; i != out.size(); ++i)
+		ASSERT_EQ(7+i, out[i]);
+	ASSERT_TRUE(rb.empty());
+}
+
+TEST(RingBufferTest, PeekDoesNotConsume){
+	TestBuffer rb;
+	write(rb, 4, 1);
+
+	std::vector<uint8_t> out(2);
+	rb.peek(buffer(out));
+	ASSERT_EQ(4u, rb.size());
+	ASSERT_EQ(1, out[0]);
+	ASSERT_EQ(2, out[1]);
+}
+
+TEST(RingBufferTest, HandlesDataWrappingAround){
+	TestBuffer rb;
+	write(rb, 12, 0);
+	rb.consume(10);
+
+	auto free = rb.prepare();
+	ASSERT_EQ(4u, buffer_size(free[0]));
+	ASSERT_EQ(10u, buffer_size(free[1]));
+
+	write(rb, 14, 12);
+	ASSERT_EQ(0u, rb.available());
+
+	std::vector<uint8_t> out(16);
+	rb.read(buffer(out));
+
+	for(unsigned i = 0; i != out.size(); ++i)
+		ASSERT_EQ(10+i, out[i]);
+}
+
+TEST(RingBufferTest, BorrowsStorageOnlyWhileInUse){
+	TestBuffer rb;
+	ASSERT_FALSE(rb.hasStorage());
+
+	write(rb, 6, 3);
+	ASSERT_TRUE(rb.hasStorage());
+
+	std::vector<uint8_t> out(6);
+	rb.read(buffer(out));
+	rb.release();
+	ASSERT_FALSE(rb.hasStorage());
+
+	write(rb, 4, 9);
+	rb.read(buffer(out, 4));
+	ASSERT_EQ(9, out[0]);
+	ASSERT_EQ(12, out[3]);
+}
+
+TEST(RingBufferTest, TakesDataAndStorageOverFromAnotherBuffer){
+	TestBuffer from, to;
+	write(from, 5, 1);
+	from.consume(2);
+
+	to.takeFrom(from);
+	ASSERT_FALSE(from.hasStorage());
+	ASSERT_EQ(3u, to.size());
+
+	std::vector<uint8_t> out(3);
+	to.read(buffer(out));
+	ASSERT_EQ(3, out[0]);
+	ASSERT_EQ(5, out[2]);
+}
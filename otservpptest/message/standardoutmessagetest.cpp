@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+#include <boost/asio/buffer.hpp>
+#include "otservpp/message/standardoutmessage.h"
+
+using otservpp::StandardOutMessage;
+using otservpp::crypto::Xtea;
+using boost::asio::buffer_cast;
+using boost::asio::buffer_size;
+
+namespace{
+	std::vector<uint8_t> bytesOf(const StandardOutMessage& msg)
+	{
+		auto buffer = msg.getBuffer();
+		auto data = buffer_cast<const uint8_t*>(buffer);
+		return std::vector<uint8_t>(data, data + buffer_size(buffer));
+	}
+
+	StandardOutMessage makeMessage(std::size_t bodySize)
+	{
+		StandardOutMessage msg(0x0A);
+		for(std::size_t i = 1; i < bodySize; ++i)
+			msg.addByte((uint8_t)(i*7));
+		return msg;
+	}
+}
+
+TEST(StandardOutMessageTest, FinalizeMatchesSeparatedPasses){
+	Xtea xtea(0x01234567, 0x89abcdef, 0xfedcba98, 0x76543210);
+
+	for(std::size_t size : {1u, 7u, 8u, 100u, 511u, 1500u, 19000u}){
+		auto separated = makeMessage(size);
+		separated.addHeader();
+		separated.xteaEncrypt(xtea);
+		separated.encode();
+
+		auto fused = makeMessage(size);
+		fused.finalize(xtea);
+
+		ASSERT_EQ(bytesOf(separated), bytesOf(fused)) << "size " << size;
+	}
+}
+
+TEST(StandardOutMessageTest, DeferredEncryptionFinalizesOnEncode){
+	Xtea xtea(1, 2, 3, 4);
+
+	auto finalized = makeMessage(300);
+	finalized.finalize(xtea);
+
+	auto deferred = makeMessage(300);
+	deferred.deferXteaEncrypt(xtea);
+	deferred.encode();
+
+	ASSERT_EQ(bytesOf(finalized), bytesOf(deferred));
+}
+
+TEST(StandardOutMessageTest, PrefixesTheWholePacketSize){
+	auto msg = makeMessage(10);
+	msg.finalize(Xtea(1, 2, 3, 4));
+
+	auto bytes = bytesOf(msg);
+	ASSERT_EQ(bytes.size() - 2, (std::size_t)(bytes[0] | bytes[1] << 8));
+	ASSERT_EQ(0u, (bytes.size() - 6) % 8);
+}
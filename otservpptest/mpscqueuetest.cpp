@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <deque>
+#include <vector>
+#include "otservpp/mpscqueue.hpp"
+
+using otservpp::MpscQueue;
+
+namespace{
+	struct TestNode : MpscQueue<TestNode>::Hook{
+		TestNode(int producer_, int seq_) :
+			producer(producer_),
+			seq(seq_)
+		{}
+
+		int producer;
+		int seq;
+	};
+}
+
+TEST(MpscQueueTest, IsEmptyOnStart){
+	MpscQueue<TestNode> queue;
+	ASSERT_EQ(nullptr, queue.pop());
+}
+
+TEST(MpscQueueTest, PopsInPushOrder){
+	MpscQueue<TestNode> queue;
+	TestNode a{0, 0}, b{0, 1}, c{0, 2};
+
+	queue.push(&a);
+	queue.push(&b);
+	ASSERT_EQ(&a, queue.pop());
+	queue.push(&c);
+	ASSERT_EQ(&b, queue.pop());
+	ASSERT_EQ(&c, queue.pop());
+	ASSERT_EQ(nullptr, queue.pop());
+}
+
+TEST(MpscQueueTest, CanBeReusedAfterBeingEmptied){
+	MpscQueue<TestNode> queue;
+	TestNode a{0, 0}, b{0, 1};
+
+	for(int i = 0; i < 3; ++i){
+		queue.push(&a);
+		ASSERT_EQ(&a, queue.pop());
+		ASSERT_EQ(nullptr, queue.pop());
+		queue.push(&b);
+		ASSERT_EQ(&b, queue.pop());
+	}
+}
+
+TEST(MpscQueueTest, KeepsPerProducerOrderWithConcurrentProducers){
+	const int producers = 4, perProducer = 20000;
+	MpscQueue<TestNode> queue;
+	std::vector<std::deque<TestNode>> nodes(producers);
+	std::vector<std::thread> threads;
+
+	for(int p = 0; p < producers; ++p){
+		for(int i = 0; i < perProducer; ++i)
+			nodes[p].emplace_back(p, i);
+
+		threads.emplace_back([&queue, &nodes, p]{
+			for(auto& node : nodes[p])
+				queue.push(&node);
+		});
+	}
+
+	std::vector<int> expected(producers, 0);
+	int popped = 0;
+	bool ordered = true;
+
+	// no ASSERT until the producers are joined, returning early would terminate instead
+	while(ordered && popped != producers*perProducer){
+		if(auto node = queue.pop()){
+			EXPECT_EQ(expected[node->producer], node->seq) << "producer " << node->producer;
+			ordered = expected[node->producer]++ == node->seq;
+			++popped;
+		}
+	}
+
+	for(auto& t : threads)
+		t.join();
+
+	ASSERT_TRUE(ordered);
+	ASSERT_EQ(nullptr, queue.pop());
+}
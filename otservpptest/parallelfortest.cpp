@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <iostream>
+#include <stdexcept>
+#include <boost/asio.hpp>
+#include "otservpp/scheduler.hpp"
+#include "otservpp/parallelfor.hpp"
+#include "otservpp/workstealingpool.h"
+
+using otservpp::Scheduler;
+using otservpp::WorkStealingPool;
+
+class ParallelForTest : public ::testing::Test{
+protected:
+	boost::asio::io_service ioService;
+	Scheduler scheduler {ioService};
+	int doneCalls = 0;
+};
+
+TEST_F(ParallelForTest, VisitsEveryIndexOnceThenCallsOnDoneInTheCallerThread){
+	std::vector<std::atomic<int>> hits(10000);
+	for(auto& hit : hits)
+		hit = 0;
+
+	auto caller = std::this_thread::get_id();
+	scheduler.parallelFor(0, hits.size(), 16, [&](std::size_t i){ ++hits[i]; }, [&]{
+		++doneCalls;
+		ASSERT_EQ(caller, std::this_thread::get_id());
+	});
+
+	// the loop keeps the io_service busy until it's done
+	ioService.run();
+	ASSERT_EQ(1, doneCalls);
+	for(auto& hit : hits)
+		ASSERT_EQ(1, hit);
+}
+
+TEST_F(ParallelForTest, HonorsTheRangeBounds){
+	std::atomic<std::size_t> sum {0};
+	scheduler.parallelFor(10, 20, 1, [&](std::size_t i){ sum += i; }, [&]{ ++doneCalls; });
+	scheduler.parallelFor(5, 5, 1, [&](std::size_t){ sum += 1000; }, [&]{ ++doneCalls; });
+
+	ioService.run();
+	ASSERT_EQ(2, doneCalls);
+	ASSERT_EQ(145u, sum);
+}
+
+TEST_F(ParallelForTest, NestsInsideParallelTasks){
+	std::atomic<int> calls {0};
+	int innerDone = 0;
+	scheduler.parallelFor(0, 8, 1, [&](std::size_t){
+		scheduler.parallelFor(0, 100, 10, [&](std::size_t){ ++calls; }, [&]{ ++innerDone; });
+	}, [&]{ ++doneCalls; });
+
+	ioService.run();
+	ASSERT_EQ(1, doneCalls);
+	ASSERT_EQ(8, innerDone);
+	ASSERT_EQ(800, calls);
+}
+
+TEST_F(ParallelForTest, RethrowsTheFirstExceptionInsteadOfCallingOnDone){
+	scheduler.parallelFor(0, 1000, 1, [](std::size_t i){
+		if(i == 500)
+			throw std::runtime_error("bad index");
+	}, [&]{ ++doneCalls; });
+
+	ASSERT_THROW(ioService.run(), std::runtime_error);
+	ASSERT_EQ(0, doneCalls);
+}
+
+TEST_F(ParallelForTest, WhenAllJoinsEveryTask){
+	std::atomic<int> sum {0};
+	std::vector<std::function<void()>> tasks;
+	for(int i = 1; i <= 10; ++i)
+		tasks.push_back([&sum, i]{ sum += i; });
+
+	scheduler.whenAll(std::move(tasks), [&]{
+		++doneCalls;
+		ASSERT_EQ(55, sum);
+	});
+
+	ioService.run();
+	ASSERT_EQ(1, doneCalls);
+}
+
+TEST_F(ParallelForTest, RunsOnAnyPool){
+	WorkStealingPool pool(4);
+	std::atomic<long> sum {0};
+	otservpp::parallelFor(pool, ioService, 0, 100000, 100, [&](std::size_t i){ sum += i; },
+			[&]{ ++doneCalls; });
+
+	ioService.run();
+	ASSERT_EQ(1, doneCalls);
+	ASSERT_EQ(99999L*100000/2, sum);
+}
+
+TEST_F(ParallelForTest, DISABLED_ScalingBenchmark){
+	const std::size_t n = 2000;
+	auto cores = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<double> results(n);
+	// something like a short pathfinding per monster
+	auto work = [&](std::size_t i){
+		double x = i;
+		for(int j = 0; j < 20000; ++j)
+			x = std::sqrt(x + j);
+		results[i] = x;
+	};
+
+	std::vector<unsigned> threadCounts;
+	for(unsigned threads = 1; threads < cores; threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(cores);
+
+	double single = 0;
+	for(auto threads : threadCounts){
+		WorkStealingPool pool(threads);
+		auto start = std::chrono::steady_clock::now();
+		otservpp::parallelFor(pool, ioService, 0, n, 1, work, []{});
+		ioService.run();
+		ioService.reset();
+		double ms = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - start).count() / 1000.0;
+
+		if(threads == 1)
+			single = ms;
+		std::cout << threads << " threads: " << ms << " ms, " << single/ms << "x" << std::endl;
+	}
+}
@@ -0,0 +1,333 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include "otservpp/protocol/connection.hpp"
+#include "otservpp/message/basicinmessage.hpp"
+
+using namespace otservpp;
+namespace asio = boost::asio;
+
+namespace {
+
+/// u16 body size followed by the body
+class FrameInMessage : public BasicInMessage<2, 64>{
+public:
+	asio::mutable_buffers_1 parseHeaderAndGetBodyBuffer()
+	{
+		setRemainingSize(getU16());
+		return getBodyBuffer();
+	}
+
+	std::string getBody()
+	{
+		return getStrChunck(getRemainingSize());
+	}
+
+	friend std::ostream& operator<<(std::ostream& os, FrameInMessage& msg)
+	{
+		return os << "FrameInMessage[size=" << msg.getSize() << "]";
+	}
+};
+
+/// Nothing is sent in these tests
+struct NoOutMessage{};
+
+/// Written as is, carries the flags the output policies look at
+class RawOutMessage{
+public:
+	RawOutMessage(std::string body_, bool droppable_ = false, uint32_t supersedeKey_ = 0) :
+		body(std::move(body_)), droppable(droppable_), supersedeKey(supersedeKey_)
+	{}
+
+	std::size_t getSize() const { return body.size(); }
+	bool isDroppable() const { return droppable; }
+	uint32_t getSupersedeKey() const { return supersedeKey; }
+	void encode(){}
+
+	asio::const_buffers_1 getBuffer() const
+	{
+		return asio::buffer(body);
+	}
+
+private:
+	std::string body;
+	bool droppable;
+	uint32_t supersedeKey;
+};
+
+class LoginStub;
+class GameStub;
+class SinkStub;
+
+} /* namespace */
+
+namespace otservpp {
+
+template <>
+struct ProtocolTraits<LoginStub> : ProtocolTraits<void>{
+	typedef FrameInMessage IncomingMessage;
+	typedef NoOutMessage OutgoingMessage;
+};
+
+template <>
+struct ProtocolTraits<GameStub> : ProtocolTraits<void>{
+	typedef FrameInMessage IncomingMessage;
+	typedef NoOutMessage OutgoingMessage;
+};
+
+template <>
+struct ProtocolTraits<SinkStub> : ProtocolTraits<void>{
+	typedef FrameInMessage IncomingMessage;
+	typedef RawOutMessage OutgoingMessage;
+};
+
+} /* namespace otservpp */
+
+namespace {
+
+/// Switches the connection to GameStub after its first message
+class LoginStub{
+public:
+	LoginStub(Connection<LoginStub>& conn_, std::shared_ptr<GameStub> game_) :
+		conn(conn_), game(std::move(game_))
+	{}
+
+	void handleFirstMessage(FrameInMessage& msg);
+	void handleMessage(FrameInMessage& msg){ bodies.push_back(msg.getBody()); }
+	void connectionLost(){}
+	const char* getName(){ return "login"; }
+
+	Connection<LoginStub>& conn;
+	std::shared_ptr<GameStub> game;
+	std::shared_ptr<Connection<GameStub>> switched;
+	std::vector<std::string> bodies;
+};
+
+/// Records one message and stops the connection
+class GameStub{
+public:
+	void handleFirstMessage(FrameInMessage& msg){ handleMessage(msg); }
+
+	void handleMessage(FrameInMessage& msg)
+	{
+		bodies.push_back(msg.getBody());
+		conn->stop();
+	}
+
+	void connectionLost(){}
+	const char* getName(){ return "game"; }
+
+	Connection<GameStub>* conn {nullptr};
+	std::vector<std::string> bodies;
+};
+
+/// Only sends, remembers whether the connection was aborted
+class SinkStub{
+public:
+	void handleFirstMessage(FrameInMessage&){}
+	void handleMessage(FrameInMessage&){}
+	void connectionLost(){ lost = true; }
+	const char* getName(){ return "sink"; }
+
+	bool lost {false};
+};
+
+void LoginStub::handleFirstMessage(FrameInMessage& msg)
+{
+	bodies.push_back(msg.getBody());
+
+	switched = std::make_shared<Connection<GameStub>>(std::move(conn));
+	game->conn = switched.get();
+	switched->start(game);
+}
+
+void appendFrame(std::string& out, const std::string& body)
+{
+	out += (char)(body.size() & 0xFF);
+	out += (char)(body.size() >> 8);
+	out += body;
+}
+
+} /* namespace */
+
+TEST(ConnectionTest, KeepsDataReadAheadAcrossAProtocolSwitch){
+	asio::io_service ioService;
+	asio::ip::tcp::acceptor acceptor(ioService,
+			asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+	asio::ip::tcp::socket client(ioService), server(ioService);
+	client.connect(acceptor.local_endpoint());
+	acceptor.accept(server);
+
+	// both frames arrive with the same read, before the switch happens
+	std::string frames;
+	appendFrame(frames, "login");
+	appendFrame(frames, "game");
+	asio::write(client, asio::buffer(frames));
+	// a lost frame makes the game connection fail on EOF instead of waiting forever
+	client.shutdown(asio::ip::tcp::socket::shutdown_send);
+
+	auto game = std::make_shared<GameStub>();
+	auto conn = std::make_shared<Connection<LoginStub>>(std::move(server));
+	auto login = std::make_shared<LoginStub>(*conn, game);
+	conn->start(login);
+
+	ioService.run();
+
+	ASSERT_EQ(std::vector<std::string>{"login"}, login->bodies);
+	ASSERT_EQ(std::vector<std::string>{"game"}, game->bodies);
+	ASSERT_TRUE(conn->isStopped());
+	ASSERT_TRUE(login->switched->isStopped());
+}
+
+/*! A started connection to a loopback client
+ * Messages sent before running the io_service are drained together, the first one is
+ * written right away and the rest are queued behind it, so they go through the output
+ * policies.
+ */
+class ConnectionOutputTest : public ::testing::Test{
+protected:
+	ConnectionOutputTest() :
+		acceptor(ioService, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0)),
+		client(ioService)
+	{
+		asio::ip::tcp::socket server(ioService);
+		client.connect(acceptor.local_endpoint());
+		acceptor.accept(server);
+
+		conn = std::make_shared<Connection<SinkStub>>(std::move(server));
+		sink = std::make_shared<SinkStub>();
+		conn->start(sink);
+	}
+
+	void setLimits(std::size_t soft, std::size_t hard, std::size_t maxMessages, int policy)
+	{
+		conn->setOutputLimits(OutputLimits{soft, hard, maxMessages, policy});
+	}
+
+	/// Everything the client received until the connection was closed
+	std::string received()
+	{
+		boost::system::error_code e;
+		asio::streambuf buffer;
+		asio::read(client, buffer, e);
+
+		return std::string(asio::buffers_begin(buffer.data()), asio::buffers_end(buffer.data()));
+	}
+
+	asio::io_service ioService;
+	asio::ip::tcp::acceptor acceptor;
+	asio::ip::tcp::socket client;
+	std::shared_ptr<Connection<SinkStub>> conn;
+	std::shared_ptr<SinkStub> sink;
+};
+
+TEST_F(ConnectionOutputTest, DropsDroppablesWhileCongested){
+	setLimits(10, 1000, 100, OutputLimits::DropDroppable);
+
+	conn->send(RawOutMessage("aaaaaaaaaaaa"));
+	conn->send(RawOutMessage("x", true));
+	conn->send(RawOutMessage("b"));
+	conn->sendAndStop(RawOutMessage("end"));
+	ioService.run();
+
+	ASSERT_EQ("aaaaaaaaaaaabend", received());
+	ASSERT_FALSE(sink->lost);
+}
+
+TEST_F(ConnectionOutputTest, CollapsesSupersededMessagesWhileCongested){
+	setLimits(1, 1000, 100, OutputLimits::CollapseSuperseded);
+
+	// the first one is being written already, it can't be replaced
+	conn->send(RawOutMessage("first", false, 1));
+	conn->send(RawOutMessage("A1", false, 1));
+	conn->send(RawOutMessage("B1", false, 1));
+	conn->send(RawOutMessage("C2", false, 2));
+	conn->sendAndStop(RawOutMessage("end"));
+	ioService.run();
+
+	ASSERT_EQ("firstB1C2end", received());
+}
+
+TEST_F(ConnectionOutputTest, DropsQueuedDroppablesToStayUnderTheHardLimit){
+	setLimits(15, 20, 100, OutputLimits::DropDroppable | OutputLimits::Disconnect);
+
+	conn->send(RawOutMessage("aaaaaaaaaaaa"));
+	// queued before the connection got congested
+	conn->send(RawOutMessage("dd", true));
+	conn->send(RawOutMessage("ccccccc"));
+	conn->sendAndStop(RawOutMessage("end"));
+	ioService.run();
+
+	ASSERT_EQ("aaaaaaaaaaaacccccccend", received());
+	ASSERT_FALSE(sink->lost);
+}
+
+TEST_F(ConnectionOutputTest, DisconnectsWhenTheHardLimitStillDoesntHold){
+	setLimits(1, 20, 100, OutputLimits::DropDroppable | OutputLimits::Disconnect);
+
+	conn->send(RawOutMessage("aaaaaaaaaaaa"));
+	conn->send(RawOutMessage("bbbbb"));
+	conn->send(RawOutMessage("ccccc"));
+	conn->sendAndStop(RawOutMessage("end"));
+	ioService.run();
+
+	ASSERT_TRUE(sink->lost);
+	ASSERT_TRUE(conn->isStopped());
+	// at most the message being written when the connection was aborted gets through
+	ASSERT_EQ(std::string::npos, received().find_first_of("bce"));
+}
+
+TEST_F(ConnectionOutputTest, RefusesMessagesPastTheHardLimitWithoutDisconnect){
+	setLimits(1, 20, 100, OutputLimits::DropDroppable);
+
+	conn->send(RawOutMessage("aaaaaaaaaaaa"));
+	conn->send(RawOutMessage("bbbbb"));
+	conn->send(RawOutMessage("ccccc"));
+	conn->send(RawOutMessage("dd"));
+	conn->sendAndStop(RawOutMessage("end"));
+	ioService.run();
+
+	ASSERT_EQ("aaaaaaaaaaaabbbbbddend", received());
+	ASSERT_FALSE(sink->lost);
+}
+
+TEST_F(ConnectionOutputTest, DisconnectsPastTheMessageCountLimit){
+	setLimits(1000, 1000, 3, OutputLimits::Disconnect);
+
+	conn->send(RawOutMessage("1"));
+	conn->send(RawOutMessage("2"));
+	conn->send(RawOutMessage("3"));
+	conn->send(RawOutMessage("4"));
+	ioService.run();
+
+	ASSERT_TRUE(sink->lost);
+	ASSERT_EQ(std::string::npos, received().find('4'));
+}
+
+TEST_F(ConnectionOutputTest, WritesQueuedMessagesInOrder){
+	// all but the first one are queued behind it, and written together with a gather write
+	std::string expected;
+	for(int i = 0; i < 100; ++i){
+		auto body = "message " + std::to_string(i) + ";";
+		expected += body;
+		conn->send(RawOutMessage(body));
+	}
+	conn->sendAndStop(RawOutMessage("end"));
+	expected += "end";
+
+	ioService.run();
+
+	ASSERT_EQ(expected, received());
+}
+
+TEST_F(ConnectionOutputTest, NeverWritesMessagesQueuedAfterSendAndStop){
+	conn->send(RawOutMessage("first"));
+	conn->sendAndStop(RawOutMessage("last"));
+	conn->send(RawOutMessage("late"));
+	ioService.run();
+
+	ASSERT_EQ("firstlast", received());
+	ASSERT_FALSE(sink->lost);
+}
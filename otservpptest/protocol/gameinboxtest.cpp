@@ -0,0 +1,37 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include "otservpp/protocol/gameinbox.h"
+
+using otservpp::GameInbox;
+
+TEST(GameInboxTest, RunsTasksInPostingOrder){
+	GameInbox inbox;
+	std::vector<int> order;
+	for(int i = 0; i != 3; ++i)
+		inbox.post([&order, i]{ order.push_back(i); });
+
+	ASSERT_TRUE(order.empty());
+	ASSERT_EQ(3u, inbox.drain());
+	ASSERT_EQ((std::vector<int>{0, 1, 2}), order);
+	ASSERT_EQ(0u, inbox.drain());
+}
+
+TEST(GameInboxTest, RunsTasksPostedFromManyThreads){
+	GameInbox inbox;
+	int runs = 0;
+
+	std::vector<std::thread> producers;
+	for(int t = 0; t != 4; ++t){
+		producers.emplace_back([&]{
+			for(int i = 0; i != 1000; ++i)
+				inbox.post([&]{ ++runs; });
+		});
+	}
+
+	for(auto& producer : producers)
+		producer.join();
+
+	inbox.drain();
+	ASSERT_EQ(4000, runs);
+}
@@ -0,0 +1,35 @@
+#include <gtest/gtest.h>
+#include "otservpp/protocol/outputlimits.h"
+
+using otservpp::OutputLimits;
+using otservpp::OutputPressure;
+
+namespace{
+	const OutputLimits limits{100, 1000, 10, OutputLimits::Disconnect};
+}
+
+TEST(OutputPressureTest, TracksQueuedBytes){
+	OutputPressure pressure;
+	pressure.add(60, limits);
+	pressure.add(30, limits);
+	pressure.remove(50, limits);
+	ASSERT_EQ(40u, pressure.queuedBytes());
+	ASSERT_FALSE(pressure.isCongested());
+}
+
+TEST(OutputPressureTest, CountsCongestedConnections){
+	auto base = OutputPressure::congestedConnections();
+	{
+		OutputPressure a, b;
+		a.add(101, limits);
+		b.add(100, limits);
+		ASSERT_TRUE(a.isCongested());
+		ASSERT_FALSE(b.isCongested());
+		ASSERT_EQ(base + 1, OutputPressure::congestedConnections());
+
+		b.add(1000, limits);
+		a.remove(50, limits);
+		ASSERT_EQ(base + 1, OutputPressure::congestedConnections());
+	}
+	ASSERT_EQ(base, OutputPressure::congestedConnections());
+}
@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <stdexcept>
+#include <boost/asio.hpp>
+#include "otservpp/protocol/standardprotocol.hpp"
+
+using namespace otservpp;
+namespace asio = boost::asio;
+
+namespace {
+
+/// Exposes the send functions, nothing is received in these tests
+class SenderStub : public StandardProtocol<SenderStub>{
+public:
+	SenderStub(const ConnectionPtr<SenderStub>& conn) :
+		StandardProtocol<SenderStub>(conn)
+	{}
+
+	void onFirstMessage(StandardInMessage&){}
+	void onMessage(StandardInMessage&){ throw std::runtime_error("protocol bug"); }
+	const char* getName(){ return "sender"; }
+
+	using StandardProtocol<SenderStub>::write;
+	using StandardProtocol<SenderStub>::sendAndStop;
+};
+
+StandardOutMessage makeMessage(std::size_t bodySize)
+{
+	StandardOutMessage msg(0x0A);
+	for(std::size_t i = 1; i < bodySize; ++i)
+		msg.addByte((uint8_t)i);
+	return msg;
+}
+
+/// Bytes the given messages take on the wire when aggregated in one packet
+std::size_t packetSize(const std::vector<std::size_t>& bodySizes)
+{
+	StandardOutMessage packet;
+	for(auto size : bodySizes)
+		packet.addMessage(makeMessage(size));
+	packet.finalize(crypto::Xtea());
+	return packet.getSize();
+}
+
+} /* namespace */
+
+class StandardProtocolTest : public ::testing::Test{
+protected:
+	StandardProtocolTest() :
+		acceptor(ioService, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0)),
+		client(ioService)
+	{
+		asio::ip::tcp::socket server(ioService);
+		client.connect(acceptor.local_endpoint());
+		acceptor.accept(server);
+
+		conn = std::make_shared<Connection<SenderStub>>(std::move(server));
+		sender = std::make_shared<SenderStub>(conn);
+	}
+
+	/// Bytes received by the client until the connection was closed
+	std::size_t receivedBytes()
+	{
+		boost::system::error_code e;
+		std::vector<uint8_t> received(2*STANDARD_OUT_MESSAGE_MAX_SIZE);
+		auto bytes = asio::read(client, asio::buffer(received), e);
+
+		EXPECT_EQ(asio::error::eof, e);
+		return bytes;
+	}
+
+	asio::io_service ioService;
+	asio::ip::tcp::acceptor acceptor;
+	asio::ip::tcp::socket client;
+	ConnectionPtr<SenderStub> conn;
+	std::shared_ptr<SenderStub> sender;
+};
+
+TEST_F(StandardProtocolTest, DropsWritesBiggerThanAPacket){
+	ASSERT_TRUE(sender->write(makeMessage(100)));
+	ASSERT_FALSE(sender->write(makeMessage(STANDARD_OUT_MESSAGE_MAX_SIZE)));
+	ASSERT_TRUE(sender->write(makeMessage(200)));
+
+	sender->sendAndStop(makeMessage(10));
+	ioService.run();
+
+	// the two written messages share a packet, the dropped one isn't in it
+	ASSERT_EQ(packetSize({100, 200}) + packetSize({10}), receivedBytes());
+}
+
+TEST_F(StandardProtocolTest, FlushesFromTheStrandWithoutAGameLoop){
+	// nothing drives the TickFlushList in this test
+	sender->write(makeMessage(100));
+	sender->write(makeMessage(200));
+
+	ioService.poll();
+	conn->stop();
+	ioService.run();
+
+	ASSERT_EQ(packetSize({100, 200}), receivedBytes());
+}
+
+TEST_F(StandardProtocolTest, StopsTheConnectionOnUnexpectedExceptions){
+	StandardInMessage msg;
+	sender->handleGameMessage(msg, *conn);
+	ioService.run();
+
+	ASSERT_TRUE(conn->isStopped());
+}
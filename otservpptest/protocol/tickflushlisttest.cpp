@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+#include "otservpp/protocol/tickflushlist.h"
+
+using otservpp::TickFlushList;
+
+TEST(TickFlushListTest, CallsEachFlushOnce){
+	TickFlushList list;
+	int calls = 0;
+	list.add([&]{ ++calls; });
+	list.add([&]{ ++calls; });
+	ASSERT_EQ(2u, list.size());
+
+	list.flushAll();
+	ASSERT_EQ(2, calls);
+	ASSERT_EQ(0u, list.size());
+
+	list.flushAll();
+	ASSERT_EQ(2, calls);
+}
+
+TEST(TickFlushListTest, KeepsFlushesAddedWhileFlushingForNextTick){
+	TickFlushList list;
+	int calls = 0;
+	list.add([&]{
+		++calls;
+		list.add([&]{ ++calls; });
+	});
+
+	list.flushAll();
+	ASSERT_EQ(1, calls);
+	ASSERT_EQ(1u, list.size());
+
+	list.flushAll();
+	ASSERT_EQ(2, calls);
+}
+
+TEST(TickFlushListTest, AddsOnlyWhileDriven){
+	TickFlushList list;
+	int calls = 0;
+	ASSERT_FALSE(list.addIfDriven([&]{ ++calls; }));
+
+	list.setDriven(true);
+	ASSERT_TRUE(list.addIfDriven([&]{ ++calls; }));
+	list.setDriven(false);
+	ASSERT_FALSE(list.addIfDriven([&]{ ++calls; }));
+
+	list.flushAll();
+	ASSERT_EQ(1, calls);
+}
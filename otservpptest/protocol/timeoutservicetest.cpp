@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <boost/asio.hpp>
+#include "otservpp/protocol/timeoutservice.h"
+
+using otservpp::TimeoutService;
+
+class TimeoutServiceTest : public ::testing::Test{
+protected:
+	boost::asio::io_service ioService;
+	int timeouts = 0;
+};
+
+TEST_F(TimeoutServiceTest, CallsHandlerOfExpiredEntry){
+	TimeoutService::Entry entry(ioService);
+	entry.setHandler([this]{ ++timeouts; });
+	entry.touch(1);
+
+	ioService.run();
+	ASSERT_EQ(1, timeouts);
+}
+
+TEST_F(TimeoutServiceTest, DoesNotCallHandlerOfCanceledEntry){
+	TimeoutService::Entry entry(ioService), other(ioService);
+	entry.setHandler([this]{ ++timeouts; });
+	entry.touch(1);
+	other.touch(1);
+	entry.cancel();
+
+	ioService.run();
+	ASSERT_EQ(0, timeouts);
+}
+
+TEST_F(TimeoutServiceTest, TouchingPostponesExpiration){
+	TimeoutService::Entry entry(ioService), probe(ioService);
+	bool probed = false;
+	entry.setHandler([this]{ ++timeouts; });
+	probe.setHandler([&]{ probed = true; ASSERT_EQ(0, timeouts); });
+	entry.touch(1);
+	probe.touch(1);
+	entry.touch(2);
+
+	ioService.run();
+	ASSERT_TRUE(probed);
+	ASSERT_EQ(1, timeouts);
+}
+
+TEST_F(TimeoutServiceTest, StopsTickingWhenNothingIsRegistered){
+	TimeoutService::Entry entry(ioService);
+	entry.touch(1);
+	entry.cancel();
+
+	// only the pending sweep remains, after it the io_service runs out of work
+	ASSERT_LE(ioService.run(), 1u);
+}
+
+TEST_F(TimeoutServiceTest, HandlerCanDestroyItsOwnEntry){
+	std::unique_ptr<TimeoutService::Entry> entry(new TimeoutService::Entry(ioService));
+	TimeoutService::Entry other(ioService);
+	entry->setHandler([&]{ ++timeouts; entry.reset(); });
+	other.setHandler([this]{ ++timeouts; });
+	entry->touch(1);
+	other.touch(1);
+
+	ioService.run();
+	ASSERT_FALSE(entry);
+	ASSERT_EQ(2, timeouts);
+}
+
+TEST_F(TimeoutServiceTest, DoesNotCallEntriesTouchedAfterExpiring){
+	TimeoutService::Entry late(ioService), first(ioService);
+	late.setHandler([this]{ ++timeouts; });
+	// both expire in the same sweep, the last one touched is handled first
+	late.touch(1);
+	first.setHandler([&]{ late.touch(1); });
+	first.touch(1);
+
+	ioService.run_one();
+	ASSERT_EQ(0, timeouts);
+
+	ioService.run();
+	ASSERT_EQ(1, timeouts);
+}
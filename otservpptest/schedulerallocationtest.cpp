@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+#include <new>
+#include <chrono>
+#include <cstdlib>
+#include <boost/asio.hpp>
+#include "otservpp/scheduler.hpp"
+#include "otservpp/timerwheel.h"
+
+using otservpp::Scheduler;
+using otservpp::TimerWheel;
+
+namespace{
+	// only the allocations of the thread running the test are counted
+	thread_local bool counting = false;
+	thread_local uint64_t allocations = 0;
+}
+
+/* Every form is replaced, so each delete matches the new it's paired with. The deletes aren't
+ * inlined, otherwise g++ sees new expressions paired with free() (-Wmismatched-new-delete).
+ */
+void* operator new(std::size_t size)
+{
+	if(counting)
+		++allocations;
+	if(void* p = std::malloc(size))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+__attribute__((noinline))
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+__attribute__((noinline))
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+__attribute__((noinline))
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+__attribute__((noinline))
+void operator delete[](void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+class SchedulerAllocationTest : public ::testing::Test{
+protected:
+	/*! Runs a chain of n timers, each one scheduled by the previous one like a server does,
+	 * returns the allocations made after the first warmUp timers
+	 */
+	uint64_t runChain(Scheduler& scheduler, int n, int warmUp = 100)
+	{
+		scheduler_ = &scheduler;
+		left = n + warmUp;
+		counted = n;
+		next();
+		ioService.run();
+		ioService.reset();
+		return allocations;
+	}
+
+	void next()
+	{
+		if(left == counted){
+			allocations = 0;
+			counting = true;
+		}
+
+		if(left-- == 0){
+			counting = false;
+			return;
+		}
+
+		// the common case, a pointer and an int
+		int i = left;
+		scheduler_->callAfter(0, [this, i]{
+			sum += i;
+			next();
+		});
+	}
+
+	boost::asio::io_service ioService;
+	Scheduler* scheduler_;
+	int left;
+	/// Timers left when counting starts
+	int counted;
+	long sum = 0;
+};
+
+TEST_F(SchedulerAllocationTest, SchedulesCommonTimersWithoutAllocatingInTheWheel){
+	Scheduler scheduler(ioService, boost::asio::use_service<TimerWheel>(ioService));
+	ASSERT_EQ(0u, runChain(scheduler, 500));
+	ASSERT_EQ(599*600/2, sum);
+}
+
+TEST_F(SchedulerAllocationTest, SchedulesCommonTimersWithoutAllocatingWithDeadlineTimers){
+	// asio recycles the memory of the wait operations
+	Scheduler scheduler(ioService);
+	ASSERT_EQ(0u, runChain(scheduler, 500));
+	ASSERT_EQ(599*600/2, sum);
+}
+
+TEST_F(SchedulerAllocationTest, DISABLED_Benchmark){
+	Scheduler asioScheduler(ioService);
+	Scheduler wheelScheduler(ioService, boost::asio::use_service<TimerWheel>(ioService));
+	const int n = 10000;
+
+	for(auto scheduler : {&asioScheduler, &wheelScheduler}){
+		auto start = std::chrono::steady_clock::now();
+		auto mallocs = runChain(*scheduler, n);
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - start).count();
+
+		// 0ms timers still wait for the next millisecond in the wheel
+		std::cout << (scheduler == &asioScheduler? "deadline_timer" : "timer wheel")
+				<< ": " << (double)mallocs/n << " mallocs/task, "
+				<< (double)us*1000/n << " ns/task" << std::endl;
+	}
+}
@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <boost/asio.hpp>
+#include "otservpp/scheduler.hpp"
+#include "otservpp/timerwheel.h"
+#include "otservpp/schedulerstats.h"
+
+using otservpp::Histogram;
+using otservpp::Scheduler;
+using otservpp::SchedulerStats;
+using otservpp::TimerWheel;
+
+TEST(HistogramTest, CountsPowersOfTwo){
+	ASSERT_EQ(0u, Histogram::bucketOf(0));
+	ASSERT_EQ(1u, Histogram::bucketOf(1));
+	ASSERT_EQ(2u, Histogram::bucketOf(2));
+	ASSERT_EQ(2u, Histogram::bucketOf(3));
+	ASSERT_EQ(11u, Histogram::bucketOf(1024));
+	ASSERT_EQ(Histogram::Buckets-1u, Histogram::bucketOf(~(uint64_t)0));
+
+	Histogram h;
+	for(uint64_t v = 1; v <= 100; ++v)
+		h.add(v);
+
+	ASSERT_EQ(100u, h.count);
+	ASSERT_EQ(50u, h.average());
+	ASSERT_EQ(100u, h.max);
+	ASSERT_EQ(63u, h.percentile(50));
+	ASSERT_EQ(100u, h.percentile(99));
+	ASSERT_EQ(1u, h.percentile(0));
+}
+
+class SchedulerStatsTest : public ::testing::Test{
+protected:
+	static uint64_t runtimes(const SchedulerStats::Snapshot& s, const char* tag)
+	{
+		auto it = s.runtimes.find(tag);
+		return it == s.runtimes.end()? 0 : it->second.count;
+	}
+
+	boost::asio::io_service ioService;
+};
+
+TEST_F(SchedulerStatsTest, RecordsTimedTasksByTag){
+	Scheduler scheduler(ioService);
+	Scheduler wheelScheduler(ioService, boost::asio::use_service<TimerWheel>(ioService));
+	auto before = SchedulerStats::snapshot();
+
+	scheduler.callAfter(1, []{ std::this_thread::sleep_for(std::chrono::milliseconds(2)); },
+			"test.sleep");
+	wheelScheduler.callAfter(1, []{}, "test.sleep");
+	scheduler.callAfter(1, []{});
+	scheduler.callAfter(1000, []{}, "test.canceled")->cancel();
+
+	// each interval stops itself after 3 calls
+	otservpp::IntervalTaskPtr intervals[2];
+	int calls[2] = {0, 0};
+	for(int i = 0; i < 2; ++i){
+		intervals[i] = wheelScheduler.callEvery(1, [&, i]{
+			if(++calls[i] == 3)
+				intervals[i]->cancel();
+		}, "test.interval");
+	}
+	ioService.run();
+
+	auto after = SchedulerStats::snapshot();
+	ASSERT_EQ(2u, runtimes(after, "test.sleep") - runtimes(before, "test.sleep"));
+	ASSERT_LE(2000u, after.runtimes["test.sleep"].max);
+	ASSERT_EQ(1u, runtimes(after, SchedulerStats::Untagged)
+			- runtimes(before, SchedulerStats::Untagged));
+	ASSERT_EQ(0u, runtimes(after, "test.canceled"));
+	ASSERT_EQ(6u, runtimes(after, "test.interval") - runtimes(before, "test.interval"));
+	ASSERT_EQ(9u, after.lateness.count - before.lateness.count);
+}
+
+TEST_F(SchedulerStatsTest, KeepsTheShardsOfFinishedThreads){
+	auto before = SchedulerStats::snapshot();
+
+	std::thread([]{
+		for(int i = 0; i < 10; ++i)
+			SchedulerStats::recordRuntime("test.thread", i);
+	}).join();
+
+	auto after = SchedulerStats::snapshot();
+	ASSERT_EQ(10u, runtimes(after, "test.thread") - runtimes(before, "test.thread"));
+}
+
+TEST_F(SchedulerStatsTest, RecordsThePoolQueue){
+	Scheduler scheduler(ioService);
+	auto before = SchedulerStats::snapshot();
+
+	std::mutex mutex;
+	std::condition_variable done;
+	int left = 50;
+	for(int i = 0; i < 50; ++i){
+		scheduler.callInParallel([&]{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(--left == 0)
+				done.notify_one();
+		});
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [&]{ return left == 0; });
+	}
+
+	// the last task may still be recording
+	auto after = SchedulerStats::snapshot();
+	ASSERT_EQ(50u, after.queueDepth.count - before.queueDepth.count);
+	ASSERT_LE(49u, after.poolWait.count - before.poolWait.count);
+}
+
+TEST_F(SchedulerStatsTest, CanBeDisabled){
+	Scheduler scheduler(ioService);
+	auto before = SchedulerStats::snapshot();
+
+	SchedulerStats::setEnabled(false);
+	scheduler.callAfter(0, []{}, "test.disabled");
+	ioService.run();
+	SchedulerStats::setEnabled(true);
+
+	auto after = SchedulerStats::snapshot();
+	ASSERT_EQ(0u, runtimes(after, "test.disabled"));
+	ASSERT_EQ(before.lateness.count, after.lateness.count);
+}
@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <boost/asio.hpp>
+#include "otservpp/service/servicemanager.h"
+
+using namespace otservpp;
+namespace asio = boost::asio;
+
+namespace {
+
+/// Keeps every accepted peer open, registered in its reactor's load
+class RecordingService : public Service{
+public:
+	explicit RecordingService(uint16_t port_) :
+		port(port_)
+	{}
+
+	const std::string& getName() const override
+	{
+		static std::string name = "recording service";
+		return name;
+	}
+
+	uint16_t getPort() const override
+	{
+		return port;
+	}
+
+	void incomingConnection(asio::ip::tcp::socket&& socket) override
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto& ioService = socket.get_io_service();
+		tokens.emplace_back(new ReactorLoad::Token(ioService));
+		peers.emplace_back(new asio::ip::tcp::socket(std::move(socket)));
+	}
+
+	std::vector<asio::io_service*> getIoServices()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<asio::io_service*> ioServices;
+		for(auto& peer : peers)
+			ioServices.push_back(&peer->get_io_service());
+		return ioServices;
+	}
+
+private:
+	uint16_t port;
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ReactorLoad::Token>> tokens;
+	std::vector<std::unique_ptr<asio::ip::tcp::socket>> peers;
+};
+
+/// A port nothing is listening to right now
+uint16_t freePort(asio::io_service& ioService)
+{
+	asio::ip::tcp::acceptor probe(ioService,
+			asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	return probe.local_endpoint().port();
+}
+
+} /* namespace */
+
+class ServiceManagerTest : public ::testing::Test{
+protected:
+	ServiceManagerTest() :
+		port(freePort(ioService))
+	{}
+
+	/// Connects count clients, then accepts until the service got all of them
+	void connectClients(std::size_t count)
+	{
+		for(std::size_t i = 0; i < count; ++i){
+			clients.emplace_back(new asio::ip::tcp::socket(ioService));
+			clients.back()->connect({asio::ip::address_v4::loopback(), port});
+		}
+
+		while(service->getIoServices().size() < count)
+			ioService.run_one();
+	}
+
+	asio::io_service ioService;
+	uint16_t port;
+	RecordingService* service {nullptr};
+	std::vector<std::unique_ptr<asio::ip::tcp::socket>> clients;
+};
+
+TEST_F(ServiceManagerTest, SpreadsConnectionsBetweenReactors){
+	ReactorPool reactors(2);
+	ServiceManager manager(ioService, reactors);
+	service = new RecordingService(port);
+	manager.registerService(ServiceUniquePtr(service));
+	manager.start();
+
+	connectClients(2);
+
+	auto ioServices = service->getIoServices();
+	ASSERT_NE(ioServices[0], ioServices[1]);
+	for(auto ioService : ioServices)
+		ASSERT_TRUE(ioService == &reactors[0] || ioService == &reactors[1]);
+}
+
+TEST_F(ServiceManagerTest, KeepsAcceptingAfterRunningOutOfDescriptors){
+	ServiceManager manager(ioService);
+	service = new RecordingService(port);
+	manager.registerService(ServiceUniquePtr(service));
+	manager.start();
+	ioService.poll();
+
+	// everything needing a descriptor is opened before they run out
+	asio::ip::tcp::socket client(ioService);
+	client.open(asio::ip::tcp::v4());
+	asio::deadline_timer restoreTimer(ioService);
+
+	rlimit original;
+	ASSERT_EQ(0, getrlimit(RLIMIT_NOFILE, &original));
+	int lowestFree = ::open("/dev/null", O_RDONLY);
+	::close(lowestFree);
+
+	// accepting the client fails with EMFILE until the limit is restored
+	rlimit exhausted = original;
+	exhausted.rlim_cur = lowestFree;
+	ASSERT_EQ(0, setrlimit(RLIMIT_NOFILE, &exhausted));
+
+	bool restored = false;
+	client.connect({asio::ip::address_v4::loopback(), port});
+	restoreTimer.expires_from_now(boost::posix_time::millisec(50));
+	restoreTimer.async_wait([&](const boost::system::error_code&){
+		setrlimit(RLIMIT_NOFILE, &original);
+		restored = true;
+	});
+
+	while(service->getIoServices().empty())
+		ioService.run_one();
+
+	setrlimit(RLIMIT_NOFILE, &original);
+	ASSERT_TRUE(restored);
+}
@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+#include <boost/asio.hpp>
+#include "otservpp/scheduler.hpp"
+#include "otservpp/timerwheel.h"
+
+using otservpp::Scheduler;
+using otservpp::TaskGroup;
+using otservpp::TimerWheel;
+
+class TaskGroupTest : public ::testing::Test{
+protected:
+	boost::asio::io_service ioService;
+	Scheduler scheduler {ioService};
+	int calls = 0;
+};
+
+TEST_F(TaskGroupTest, RunsTasksUntilCanceled){
+	TaskGroup group(scheduler);
+	group.callAfter(1, [this]{ ++calls; });
+	group.callAfter(2, [this]{ ++calls; });
+	ioService.run();
+	ASSERT_EQ(2, calls);
+}
+
+TEST_F(TaskGroupTest, CancelInvalidatesEveryPendingTask){
+	TaskGroup group(scheduler);
+	for(int i = 0; i < 100; ++i)
+		group.callAfter(i % 5, [this]{ ++calls; });
+
+	group.cancel();
+	ioService.run();
+	ASSERT_EQ(0, calls);
+}
+
+TEST_F(TaskGroupTest, DestroyingTheGroupInvalidatesItsTasks){
+	{
+		TaskGroup group(scheduler);
+		group.callAfter(1, [this]{ ++calls; });
+		group.callEvery(1, [this]{ ++calls; });
+	}
+
+	ioService.run();
+	ASSERT_EQ(0, calls);
+}
+
+TEST_F(TaskGroupTest, StopsIntervalTasks){
+	TaskGroup group(scheduler);
+	group.callEvery(1, [&]{
+		if(++calls == 3)
+			group.cancel();
+	});
+
+	// run() only returns once the interval is stopped
+	ioService.run();
+	ASSERT_EQ(3, calls);
+}
+
+TEST_F(TaskGroupTest, KeepsSchedulingAfterCancel){
+	TaskGroup group(scheduler);
+	group.callAfter(1, [this]{ calls += 10; });
+	group.cancel();
+	group.callAfter(1, [this]{ ++calls; });
+
+	ioService.run();
+	ASSERT_EQ(1, calls);
+}
+
+TEST_F(TaskGroupTest, WorksWithTheTimerWheel){
+	Scheduler wheelScheduler(ioService, boost::asio::use_service<TimerWheel>(ioService));
+	TaskGroup group(wheelScheduler);
+	group.callEvery(1, [&]{
+		if(++calls == 3)
+			group.cancel();
+	});
+	group.callAfter(100, [this]{ calls += 10; });
+
+	ioService.run();
+	ASSERT_EQ(3, calls);
+	ASSERT_EQ(0u, boost::asio::use_service<TimerWheel>(ioService).size());
+}
+
+TEST_F(TaskGroupTest, CancelReleasesWhatTasksCaptured){
+	auto owner = std::make_shared<int>(0);
+	TaskGroup group(scheduler);
+	auto deferred = group.callAfter(3600000, [owner]{});
+	auto interval = group.callEvery(3600000, [owner]{});
+	ASSERT_EQ(3, owner.use_count());
+	ASSERT_EQ(2u, group.size());
+
+	// the timers are still pending, and so are the handles
+	group.cancel();
+	ASSERT_EQ(1, owner.use_count());
+	ASSERT_EQ(0u, group.size());
+
+	deferred->cancel();
+	interval->cancel();
+	ioService.run();
+	ASSERT_EQ(0, *owner);
+}
+
+TEST_F(TaskGroupTest, ForgetsTasksOnceTheyAreDone){
+	TaskGroup group(scheduler);
+	group.callAfter(1, [this]{ ++calls; });
+	group.callAfter(1, [this]{ ++calls; })->cancel();
+	ASSERT_EQ(2u, group.size());
+
+	ioService.run();
+	ASSERT_EQ(1, calls);
+	ASSERT_EQ(0u, group.size());
+}
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <boost/asio.hpp>
+#include "otservpp/scheduler.hpp"
+#include "otservpp/timerwheel.h"
+
+using otservpp::TimerWheel;
+using otservpp::Scheduler;
+using otservpp::DeferredTask;
+using otservpp::DeferredTaskPtr;
+using otservpp::makeDeferredTask;
+using boost::system::error_code;
+
+class TimerWheelTest : public ::testing::Test{
+protected:
+	boost::asio::io_service ioService;
+	TimerWheel& wheel {boost::asio::use_service<TimerWheel>(ioService)};
+};
+
+TEST_F(TimerWheelTest, FiresTasksInDeadlineOrderAcrossLevels){
+	std::vector<int> order;
+	auto record = [&](int id){
+		return [&order, id](const error_code& e){ if(!e) order.push_back(id); };
+	};
+
+	// 300ms lives in the second level until the first one wraps
+	auto t3 = makeDeferredTask(wheel, 300, record(3));
+	auto t1 = makeDeferredTask(wheel, 0, record(1));
+	auto t2 = makeDeferredTask(wheel, 20, record(2));
+	ASSERT_EQ(3u, wheel.size());
+
+	auto start = wheel.now();
+	ioService.run();
+	ASSERT_EQ((std::vector<int>{1, 2, 3}), order);
+	ASSERT_GE(wheel.now() - start, 300u);
+	ASSERT_EQ(0u, wheel.size());
+}
+
+TEST_F(TimerWheelTest, CancelPostsAbortedHandler){
+	bool called = false, aborted = false;
+	auto task = makeDeferredTask(wheel, 10000, [&](const error_code& e){
+		if(!e)
+			called = true;
+		else if(e == boost::asio::error::operation_aborted)
+			aborted = true;
+	});
+
+	ASSERT_TRUE(task->cancel());
+	ASSERT_EQ(0u, wheel.size());
+	ASSERT_FALSE(task->cancel());
+
+	ioService.poll();
+	ASSERT_TRUE(aborted);
+	ASSERT_FALSE(called);
+}
+
+TEST_F(TimerWheelTest, RestartingAbortsThePendingTask){
+	int calls = 0, aborts = 0;
+	auto fn = [&](const error_code& e){ e? ++aborts : ++calls; };
+	auto task = makeDeferredTask(wheel, 10000, fn);
+	task->start(5, fn);
+	ASSERT_EQ(1u, wheel.size());
+
+	ioService.run();
+	ASSERT_EQ(1, calls);
+	ASSERT_EQ(1, aborts);
+}
+
+TEST_F(TimerWheelTest, SchedulerRunsIntervalsUntilCanceled){
+	Scheduler scheduler(ioService, wheel);
+	int calls = 0;
+	otservpp::IntervalTaskPtr task;
+	task = scheduler.callEvery(2, [&]{
+		if(++calls == 5)
+			task->cancel();
+	});
+
+	ioService.run();
+	ASSERT_EQ(5, calls);
+	ASSERT_EQ(0u, wheel.size());
+}
+
+TEST_F(TimerWheelTest, CancelsManyTimersWithoutFiringThem){
+	Scheduler scheduler(ioService, wheel);
+	std::vector<DeferredTaskPtr> tasks;
+	int calls = 0;
+	for(int i = 0; i < 100000; ++i)
+		tasks.push_back(scheduler.callAfter(1000 + i*37, [&]{ ++calls; }));
+	ASSERT_EQ(tasks.size(), wheel.size());
+
+	for(auto& task : tasks)
+		ASSERT_TRUE(task->cancel());
+	ASSERT_EQ(0u, wheel.size());
+
+	ioService.poll();
+	ASSERT_EQ(0, calls);
+}
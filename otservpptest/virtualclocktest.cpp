@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <boost/asio.hpp>
+#include "otservpp/scheduler.hpp"
+#include "otservpp/virtualclock.h"
+
+using otservpp::Scheduler;
+using otservpp::VirtualClock;
+using otservpp::makeDeferredTask;
+using boost::system::error_code;
+
+class VirtualClockTest : public ::testing::Test{
+protected:
+	boost::asio::io_service ioService;
+	VirtualClock clock {ioService};
+	Scheduler scheduler {ioService, clock};
+};
+
+TEST_F(VirtualClockTest, RunsHoursOfIntervalsWithoutWaiting){
+	int calls = 0;
+	auto task = scheduler.callEvery(1000, [&]{ ++calls; });
+
+	auto start = std::chrono::steady_clock::now();
+	clock.runFor(10*3600*1000);
+	ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+
+	ASSERT_EQ(10*3600, calls);
+	ASSERT_EQ(10*3600*1000u, clock.now());
+
+	task->cancel();
+	clock.run();
+	ASSERT_EQ(0u, clock.size());
+}
+
+TEST_F(VirtualClockTest, RunsByDeadlineThenBySchedulingOrder){
+	std::string order;
+	scheduler.callAfter(5, [&]{ order += 'a'; });
+	scheduler.callAfter(3, [&]{ order += 'b'; });
+	scheduler.callAfter(5, [&]{ order += 'c'; });
+	scheduler.callAfter(0, [&]{ order += 'd'; });
+
+	clock.run();
+	ASSERT_EQ("dbac", order);
+	ASSERT_EQ(5u, clock.now());
+}
+
+TEST_F(VirtualClockTest, NestedTasksSeeTheVirtualTime){
+	std::vector<uint64_t> times;
+	scheduler.callAfter(10, [&]{
+		times.push_back(clock.now());
+		scheduler.callAfter(15, [&]{ times.push_back(clock.now()); });
+	});
+
+	clock.run();
+	ASSERT_EQ((std::vector<uint64_t>{10, 25}), times);
+}
+
+TEST_F(VirtualClockTest, KeepsTheDeferredTaskSemantics){
+	int calls = 0, aborts = 0;
+	auto fn = [&](const error_code& e){ e? ++aborts : ++calls; };
+	auto task = makeDeferredTask(clock, 100, fn);
+	task->start(50, fn);
+
+	clock.run();
+	ASSERT_EQ(1, calls);
+	ASSERT_EQ(1, aborts);
+	ASSERT_EQ(50u, clock.now());
+
+	task->start(10, fn);
+	ASSERT_TRUE(task->cancel());
+	clock.run();
+	ASSERT_EQ(1, calls);
+	ASSERT_EQ(2, aborts);
+	ASSERT_EQ(50u, clock.now());
+}
+
+TEST_F(VirtualClockTest, RunForStopsAtTheGivenTime){
+	int calls = 0;
+	scheduler.callAfter(100, [&]{ ++calls; });
+	scheduler.callAfter(101, [&]{ ++calls; });
+
+	clock.runFor(100);
+	ASSERT_EQ(1, calls);
+	ASSERT_EQ(100u, clock.now());
+	ASSERT_EQ(1u, clock.size());
+
+	clock.advance(5);
+	ASSERT_EQ(105u, clock.now());
+	clock.run();
+	ASSERT_EQ(2, calls);
+}
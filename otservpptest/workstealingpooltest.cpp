@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+#include <set>
+#include <chrono>
+#include <atomic>
+#include "otservpp/workstealingpool.h"
+#include "otservpp/scheduler.hpp"
+
+using otservpp::WorkStealingPool;
+using otservpp::Scheduler;
+
+namespace{
+	template <class Predicate>
+	bool waitFor(Predicate pred)
+	{
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while(!pred()){
+			if(std::chrono::steady_clock::now() > deadline)
+				return false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return true;
+	}
+}
+
+TEST(WorkStealingPoolTest, RunsEveryPostedTask){
+	WorkStealingPool pool(4);
+	std::atomic<int> calls {0};
+	for(int i = 0; i < 10000; ++i)
+		pool.post([&]{ ++calls; });
+
+	ASSERT_TRUE(waitFor([&]{ return calls == 10000; }));
+}
+
+TEST(WorkStealingPoolTest, RunsNestedTasksInTheSpawningWorkerNewestFirst){
+	WorkStealingPool pool(1);
+	std::vector<int> order;
+	std::atomic<bool> nestedInWorker {true};
+	std::atomic<int> done {0};
+
+	pool.post([&]{
+		for(int i = 0; i < 3; ++i){
+			pool.post([&, i]{
+				nestedInWorker = nestedInWorker && pool.isWorkerThread();
+				order.push_back(i);
+				++done;
+			});
+		}
+	});
+
+	ASSERT_TRUE(waitFor([&]{ return done == 3; }));
+	ASSERT_TRUE(nestedInWorker);
+	ASSERT_EQ((std::vector<int>{2, 1, 0}), order);
+	ASSERT_FALSE(pool.isWorkerThread());
+}
+
+TEST(WorkStealingPoolTest, IdleWorkersStealNestedTasks){
+	WorkStealingPool pool(4);
+	std::mutex mutex;
+	std::set<std::thread::id> threads;
+	std::atomic<int> done {0};
+
+	pool.post([&]{
+		for(int i = 0; i < 64; ++i){
+			pool.post([&]{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					threads.insert(std::this_thread::get_id());
+				}
+				++done;
+			});
+		}
+	});
+
+	ASSERT_TRUE(waitFor([&]{ return done == 64; }));
+	ASSERT_GT(threads.size(), 1u);
+}
+
+TEST(WorkStealingPoolTest, SchedulerCallsBackInCallerIoService){
+	boost::asio::io_service ioService;
+	Scheduler scheduler(ioService);
+	std::atomic<bool> ranInWorker {false};
+	bool calledBack = false;
+
+	boost::asio::io_service::work work(ioService);
+	scheduler.callInParallel([&]{ ranInWorker = true; }, [&]{
+		calledBack = true;
+		ioService.stop();
+	});
+
+	ioService.run();
+	ASSERT_TRUE(ranInWorker);
+	ASSERT_TRUE(calledBack);
+}